@@ -768,7 +768,82 @@ def print_all(args):
   print_overworld()
   print_overworld_tables()
 
-def write_assets_to_file(print_header = False):
+# LZ4 block format, greedy with a hash of the next 4 bytes. The last 5 bytes
+# are always literals and the last match ends at least 12 bytes before the end.
+def lz4_compress(data):
+  n, out, anchor, pos, table = len(data), bytearray(), 0, 0, {}
+  def put_length(v):
+    while v >= 255:
+      out.append(255)
+      v -= 255
+    out.append(v)
+  while pos + 12 <= n:
+    key = data[pos:pos + 4]
+    cand = table.get(key)
+    table[key] = pos
+    if cand is None or pos - cand > 65535:
+      pos += 1
+      continue
+    mlen = 4
+    while pos + mlen < n - 5 and data[cand + mlen] == data[pos + mlen]:
+      mlen += 1
+    lit = pos - anchor
+    out.append((min(lit, 15) << 4) | min(mlen - 4, 15))
+    if lit >= 15: put_length(lit - 15)
+    out += data[anchor:pos]
+    out += struct.pack('<H', pos - cand)
+    if mlen - 4 >= 15: put_length(mlen - 4 - 15)
+    pos += mlen
+    anchor = pos
+  lit = n - anchor
+  out.append(min(lit, 15) << 4)
+  if lit >= 15: put_length(lit - 15)
+  out += data[anchor:]
+  return bytes(out)
+
+kAssetCompression_None = 0
+kAssetCompression_Lz4 = 1
+kAssetFlag_Packed = 0x100
+
+# The v2 container has a table of (offset, size, stored size, flags) for each
+# asset and payloads aligned to 64 bytes. Packed assets can be LZ4
+# compressed, they're only accessed through FindInAssetArray and get decoded
+# on first use. The elements are found through the offset table that
+# pack_arrays puts in each packed asset.
+def write_assets_v2(assets_sig, key_sig, compress):
+  names = list(assets.keys())
+  payloads, table = [], []
+  for k in names:
+    tp, data = assets[k]
+    flags, stored = kAssetCompression_None, data
+    if tp == 'packed':
+      flags |= kAssetFlag_Packed
+      if compress and len(data) >= 256:
+        c = lz4_compress(data)
+        if len(c) < len(data) * 9 // 10:
+          flags |= kAssetCompression_Lz4
+          stored = c
+    payloads.append(stored)
+    table.append((len(data), len(stored), flags))
+
+  hdr = b'Zelda3_v2     \n\0' + assets_sig[16:] + b'\x00' * 32
+  hdr += struct.pack('<IIII', len(names), len(key_sig), 0, 0)
+  file_data_len = len(hdr) + len(table) * 16 + len(key_sig)
+  offsets = []
+  for p in payloads:
+    file_data_len = (file_data_len + 63) & ~63
+    offsets.append(file_data_len)
+    file_data_len += len(p)
+  file_data = bytearray(hdr)
+  for (size, stored, flags), offset in zip(table, offsets):
+    file_data += struct.pack('<IIII', offset, size, stored, flags)
+  file_data += key_sig
+  for p, offset in zip(payloads, offsets):
+    file_data += b'\0' * (offset - len(file_data))
+    file_data += p
+  return bytes(file_data)
+
+def write_assets_to_file(print_header = False, version = 1, compress = False):
   key_sig = b''
   all_data = []
   if print_header:
@@ -798,6 +873,10 @@ extern MemBlk FindInAssetArray(int asset, int idx);
   if print_header:
     print('#define kAssets_Sig %s' % ", ".join((str(a) for a in assets_sig)))
 
+  if version == 2:
+    open('../zelda3_assets.dat', 'wb').write(write_assets_v2(assets_sig, key_sig, compress))
+    return
+
   hdr = assets_sig + b'\x00' * 32 + struct.pack('II', len(all_data), len(key_sig))
 
   encoded_sizes = array.array('I', [len(i) for i in all_data])
@@ -813,7 +892,7 @@ extern MemBlk FindInAssetArray(int asset, int idx);
 
 def main(args):
   print_all(args)
-  write_assets_to_file(args.print_assets_header)
+  write_assets_to_file(args.print_assets_header, 2 if args.assets_v2 else 1, args.compress_assets)
 
 if __name__ == "__main__":
   ROM = util.load_rom(sys.argv[1] if len(sys.argv) >= 2 else None)
@@ -821,6 +900,8 @@ if __name__ == "__main__":
     sprites_from_png = False
     languages = None
     print_assets_header = False
+    assets_v2 = False
+    compress_assets = False
   main(DefaultArgs())
 else:
   ROM = util.ROM
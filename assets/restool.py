@@ -19,6 +19,10 @@ optional.add_argument('--no-build', action='store_true', help="Don't actually bu
 optional.add_argument('--print-strings', action='store_true', help="Print all dialogue strings")
 optional.add_argument('--print-assets-header', action='store_true')
 
+optional = parser.add_argument_group('Container format')
+optional.add_argument('--assets-v2', action='store_true', help="Write the v2 container with aligned payloads")
+optional.add_argument('--compress-assets', action='store_true', help="LZ4 compress the packed assets (only with --assets-v2)")
+
 optional = parser.add_argument_group('Image handling')
 optional.add_argument('--sprites-from-png', action='store_true', help="When compiling, load sprites from png instead of from ROM")
 
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# Load test and example client for zelda3_remote, see Zelda3_ServeRemote in
+# src/platform/lib/libzelda3.h for the protocol.
+#   python3 other/remote_loadtest.py [address] [--steps N] [--depth N] [--frames N] [--obs WxHxC]
+#                                    [--target steps/s]
+import argparse
+import random
+import socket
+import struct
+import time
+
+STEP, READ_RAM, WRITE_RAM, GET_FRAME, SAVE_STATE, LOAD_STATE, INFO = range(1, 8)
+STEP_HASH = 1
+BAD_REQUEST = 1
+HEADER = struct.Struct('<BBHI')
+
+class Remote:
+  def __init__(self, address):
+    if address.startswith('tcp:'):
+      self.sock = socket.create_connection(('127.0.0.1', int(address[4:])))
+      self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    else:
+      self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+      self.sock.connect(address[5:] if address.startswith('unix:') else address)
+    self.pending = []
+    self.buf = bytearray()
+
+  # Queues a request, nothing gets sent until flush.
+  def send(self, cmd, payload=b'', flags=0, arg=0):
+    self.pending.append(HEADER.pack(cmd, flags, arg, len(payload)) + payload)
+
+  def flush(self):
+    self.sock.sendall(b''.join(self.pending))
+    self.pending = []
+
+  def _read(self, n):
+    while len(self.buf) < n:
+      data = self.sock.recv(max(65536, n - len(self.buf)))
+      if not data:
+        raise EOFError('server closed the connection')
+      self.buf += data
+    r = bytes(self.buf[:n])
+    del self.buf[:n]
+    return r
+
+  def recv(self, cmd):
+    got, status, _, size = HEADER.unpack(self._read(HEADER.size))
+    payload = self._read(size)
+    if got != cmd or status != 0:
+      raise RuntimeError('request %d failed with status %d' % (cmd, status))
+    return payload
+
+  def call(self, cmd, payload=b'', flags=0, arg=0):
+    self.send(cmd, payload, flags, arg)
+    self.flush()
+    return self.recv(cmd)
+
+  def step(self, inputs, frames=1, want_hash=False):
+    payload = b''.join(struct.pack('<HH', a, b) for a, b in inputs)
+    r = self.call(STEP, payload, STEP_HASH if want_hash else 0, frames)
+    return struct.unpack('<Q', r)[0] if want_hash else None
+
+  def read_ram(self, addr, size):
+    return self.call(READ_RAM, struct.pack('<II', addr, size))
+
+  def write_ram(self, addr, data):
+    self.call(WRITE_RAM, struct.pack('<I', addr) + bytes(data))
+
+  def get_frame(self, width=0, height=0, channels=0):
+    return self.call(GET_FRAME, struct.pack('<HHBxxx', width, height, channels))
+
+  def save_state(self):
+    return self.call(SAVE_STATE)
+
+  def load_state(self, state):
+    self.call(LOAD_STATE, state)
+
+def check(r):
+  version, state_size, ram_size, _ = struct.unpack('<IIII', r.call(INFO))
+  print('Protocol %d, state %d bytes, ram %d bytes' % (version, state_size, ram_size))
+  state = r.save_state()
+  assert len(state) == state_size
+  old = r.read_ram(0x7f00, 4)
+  r.write_ram(0x7f00, b'\x01\x02\x03\x04')
+  assert r.read_ram(0x7f00, 4) == b'\x01\x02\x03\x04'
+  r.load_state(state)
+  assert r.read_ram(0x7f00, 4) == old
+  assert len(r.get_frame()) == 256 * 224 * 4
+  assert len(r.get_frame(84, 84, 1)) == 84 * 84
+  # Steps of 0 frames are malformed, like a bad RAM range.
+  for arg, payload in ((0, struct.pack('<HH', 0, 0)), (1, b'\0' * 3)):
+    r.send(STEP, payload, 0, arg)
+    r.flush()
+    got, status, _, size = HEADER.unpack(r._read(HEADER.size))
+    assert got == STEP and status == BAD_REQUEST and size == 0
+  return state
+
+def main():
+  ap = argparse.ArgumentParser()
+  ap.add_argument('address', nargs='?', default='unix:zelda3.sock')
+  ap.add_argument('--steps', type=int, default=20000)
+  ap.add_argument('--depth', type=int, default=64, help='requests in flight')
+  ap.add_argument('--frames', type=int, default=1, help='frames per step, 0 only measures the protocol')
+  ap.add_argument('--obs', help='also get a WxHxC observation after each step, like 84x84x1')
+  ap.add_argument('--target', type=int, default=5000, help='steps/s the server should reach')
+  args = ap.parse_args()
+  obs = tuple(int(x) for x in args.obs.split('x')) if args.obs else None
+
+  r = Remote(args.address)
+  state = check(r)
+
+  # Each step is a request of its own, up to |depth| of them in flight,
+  # followed by a read of Link's coordinates like an agent would do, and
+  # the observation if asked for.
+  rng = random.Random(1)
+  t = time.perf_counter()
+  done = 0
+  while done < args.steps:
+    n = min(args.depth, args.steps - done)
+    for i in range(n):
+      # With 0 frames the steps carry no inputs, so nothing runs.
+      payload = struct.pack('<HH', rng.getrandbits(12), 0) if args.frames else b''
+      r.send(STEP, payload, 0, max(args.frames, 1))
+      r.send(READ_RAM, struct.pack('<II', 0x20, 4))
+      if obs:
+        r.send(GET_FRAME, struct.pack('<HHBxxx', *obs))
+    r.flush()
+    for i in range(n):
+      r.recv(STEP)
+      r.recv(READ_RAM)
+      if obs:
+        r.recv(GET_FRAME)
+    done += n
+  secs = time.perf_counter() - t
+  print('%d steps of %d frames at depth %d, %s: %.0f steps/s, %.0f frames/s' % (
+      args.steps, args.frames, args.depth, 'observation ' + args.obs if obs else 'no observation',
+      args.steps / secs, args.steps * args.frames / secs))
+  if args.frames == 0:
+    print('Target of %d steps/s not checked, 0 frame steps only measure the protocol' % args.target)
+  else:
+    print('Target of %d steps/s %s' % (args.target, 'met' if args.steps / secs >= args.target else 'MISSED'))
+
+  # Stepping the same inputs from the same state must give the same hash.
+  hashes = []
+  for i in range(2):
+    r.load_state(state)
+    hashes.append(r.step([(0x80, 0)] * 8 if args.frames else [], max(args.frames, 1), want_hash=True))
+  print('Replay hashes %016x %016x %s' % (hashes[0], hashes[1], 'match' if hashes[0] == hashes[1] else 'DIFFER'))
+  r.load_state(state)
+
+if __name__ == '__main__':
+  main()
@@ -181,4 +181,5 @@ void apu_cpuWrite(Apu* apu, uint16_t adr, uint8_t val) {
     }
   }
   apu->ram[adr] = val;
+  dsp_invalidateBrrCache(apu->dsp, adr, 1);
 }
@@ -8,9 +8,17 @@
 #include <limits.h>
 #include "dsp_regs.h"
 #include "dsp.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MY_CHANGES 1
 
+// dsp_cycleBlock renders at most this many samples at a time.
+enum { kDspBlockSize = 64 };
+// Number of decoded brr blocks kept, a power of 2.
+enum { kDspBrrCacheSize = 1024 };
+
 static const int rateValues[32] = {
   0, 2048, 1536, 1280, 1024, 768, 640, 512,
   384, 320, 256, 192, 160, 128, 96, 80,
@@ -53,8 +61,8 @@ static const int gaussValues[512] = {
   0x513, 0x514, 0x514, 0x515, 0x516, 0x516, 0x517, 0x517, 0x517, 0x518, 0x518, 0x518, 0x518, 0x518, 0x519, 0x519
 };
 
-static void dsp_cycleChannel(Dsp* dsp, int ch);
-static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR);
+static int16_t dsp_cycleChannel(Dsp* dsp, int ch, int16_t prevOut, int16_t noiseSample);
+static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR, const int16_t* voiceOut, int stride);
 static void dsp_handleGain(Dsp* dsp, int ch);
 static void dsp_decodeBrr(Dsp* dsp, int ch);
 static int16_t dsp_getSample(Dsp* dsp, int ch, int sampleNum, int offset);
@@ -63,13 +71,34 @@ static void dsp_handleNoise(Dsp* dsp);
 Dsp* dsp_init(uint8_t *apu_ram) {
   Dsp* dsp = (Dsp*)malloc(sizeof(Dsp));
   dsp->apu_ram = apu_ram;
+  dsp->echoGuardLen = 0;
+  dsp->echoGuardHit = false;
+  dsp->brrCache = (DspBrrCacheEntry*)calloc(kDspBrrCacheSize, sizeof(DspBrrCacheEntry));
+  dsp->brrCacheGeneration = 1;
+  dsp->brrCacheHits = 0;
+  dsp->brrCacheMisses = 0;
+  memset(dsp->brrCachePages, 0, sizeof(dsp->brrCachePages));
   return dsp;
 }
 
 void dsp_free(Dsp* dsp) {
+  free(dsp->brrCache);
   free(dsp);
 }
 
+void dsp_invalidateBrrCache(Dsp* dsp, uint16_t adr, uint32_t len) {
+  if(len == 0) return;
+  uint32_t first = adr >> 8, last = (adr + len - 1) >> 8;
+  bool hit = last - first >= 255;
+  for(uint32_t page = first; page <= last && !hit; page++) {
+    hit = dsp->brrCachePages[page & 0xff];
+  }
+  if(hit) {
+    dsp->brrCacheGeneration++;
+    memset(dsp->brrCachePages, 0, sizeof(dsp->brrCachePages));
+  }
+}
+
 void dsp_reset(Dsp* dsp) {
   memset(dsp->ram, 0, sizeof(dsp->ram));
   dsp->ram[ENDX] = 0xff; // set ENDX bit for all channels
@@ -123,17 +152,21 @@ void dsp_reset(Dsp* dsp) {
   memset(dsp->firBufferR, 0, sizeof(dsp->firBufferR));
   memset(dsp->sampleBuffer, 0, sizeof(dsp->sampleBuffer));
   dsp->sampleOffset = 0;
+  dsp_invalidateBrrCache(dsp, 0, 0x10000);
 }
 
 void dsp_saveload(Dsp *dsp, SaveLoadFunc *func, void *ctx) {
   func(ctx, &dsp->ram, sizeof(Dsp) - offsetof(Dsp, ram));
+  // apu ram is loaded together with the dsp
+  dsp_invalidateBrrCache(dsp, 0, 0x10000);
 }
 
 void dsp_cycle(Dsp* dsp) {
   int totalL = 0;
   int totalR = 0;
+  int16_t voiceOut[8];
   for(int i = 0; i < 8; i++) {
-    dsp_cycleChannel(dsp, i);
+    voiceOut[i] = dsp_cycleChannel(dsp, i, i > 0 ? dsp->channel[i - 1].sampleOut : 0, dsp->noiseSample);
     totalL += (dsp->channel[i].sampleOut * dsp->channel[i].volumeL) >> 6;
     totalR += (dsp->channel[i].sampleOut * dsp->channel[i].volumeR) >> 6;
     totalL = totalL < -0x8000 ? -0x8000 : (totalL > 0x7fff ? 0x7fff : totalL); // clamp 16-bit
@@ -143,7 +176,7 @@ void dsp_cycle(Dsp* dsp) {
   totalR = (totalR * dsp->masterVolumeR) >> 7;
   totalL = totalL < -0x8000 ? -0x8000 : (totalL > 0x7fff ? 0x7fff : totalL); // clamp 16-bit
   totalR = totalR < -0x8000 ? -0x8000 : (totalR > 0x7fff ? 0x7fff : totalR); // clamp 16-bit
-  dsp_handleEcho(dsp, &totalL, &totalR);
+  dsp_handleEcho(dsp, &totalL, &totalR, voiceOut, 1);
   if(dsp->mute) {
     totalL = 0;
     totalR = 0;
@@ -158,7 +191,247 @@ void dsp_cycle(Dsp* dsp) {
   dsp->evenCycle = !dsp->evenCycle;
 }
 
-static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
+#if defined(__SSE2__)
+// Sign extends the low/high 4 lanes of 16-bit values to 32 bits.
+static inline __m128i dsp_lo32(__m128i x) { return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); }
+static inline __m128i dsp_hi32(__m128i x) { return _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16); }
+
+// Full 32-bit products of 8 16-bit lanes, shifted right.
+static inline void dsp_mulShift(__m128i s, __m128i v, __m128i shift, __m128i* lo, __m128i* hi) {
+  __m128i l = _mm_mullo_epi16(s, v), h = _mm_mulhi_epi16(s, v);
+  *lo = _mm_sra_epi32(_mm_unpacklo_epi16(l, h), shift);
+  *hi = _mm_sra_epi32(_mm_unpackhi_epi16(l, h), shift);
+}
+#endif
+
+// dst[i] = clamp16(dst[i] + ((src[i] * volume) >> shift)), the operation
+// used for all mixing. packs_epi32 saturates exactly like the clamp.
+static void dsp_addScaled(int16_t* dst, const int16_t* src, int volume, int shift, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i v = _mm_set1_epi16(volume), sh = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)&dst[i]), p0, p1;
+    dsp_mulShift(_mm_loadu_si128((const __m128i*)&src[i]), v, sh, &p0, &p1);
+    a = _mm_packs_epi32(_mm_add_epi32(dsp_lo32(a), p0), _mm_add_epi32(dsp_hi32(a), p1));
+    _mm_storeu_si128((__m128i*)&dst[i], a);
+  }
+#endif
+  for (; i < n; i++) {
+    int t = dst[i] + ((src[i] * volume) >> shift);
+    dst[i] = t < -0x8000 ? -0x8000 : (t > 0x7fff ? 0x7fff : t); // clamp 16-bit
+  }
+}
+
+// Sums the voices of a block like dsp_cycle does, clamping to 16 bits after
+// each voice. A voice with volume 0 leaves the clamped sum unchanged.
+static void dsp_sumVoices(int16_t voiceOut[8][kDspBlockSize], const int8_t* volume, int16_t* dst, int n) {
+  memset(dst, 0, n * sizeof(int16_t));
+  for (int ch = 0; ch < 8; ch++) {
+    if (volume[ch] != 0)
+      dsp_addScaled(dst, voiceOut[ch], volume[ch], 6, n);
+  }
+}
+
+// Applies the master volume to the summed voices.
+static void dsp_mixVoices(int16_t voiceOut[8][kDspBlockSize], const int8_t* volume,
+                          int8_t masterVolume, int16_t* dst, int n) {
+  int16_t sum[kDspBlockSize];
+  dsp_sumVoices(voiceOut, volume, sum, n);
+  memset(dst, 0, n * sizeof(int16_t));
+  dsp_addScaled(dst, sum, masterVolume, 7, n);
+}
+
+// The 8-tap echo FIR for |n| samples. x[i + 7] is the echo sample read at
+// cycle i, x[0..6] the samples before. The sum wraps to 16 bits before the
+// last tap and is clamped after it.
+static void dsp_firFilter(const int16_t* x, const int8_t* firValues, int16_t* dst, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i sh = _mm_cvtsi32_si128(6);
+  for (; i + 8 <= n; i += 8) {
+    __m128i s0 = _mm_setzero_si128(), s1 = _mm_setzero_si128(), p0, p1;
+    for (int t = 0; t < 8; t++) {
+      if (t == 7) {
+        s0 = _mm_srai_epi32(_mm_slli_epi32(s0, 16), 16); // clip 16-bit
+        s1 = _mm_srai_epi32(_mm_slli_epi32(s1, 16), 16);
+      }
+      dsp_mulShift(_mm_loadu_si128((const __m128i*)&x[i + t]), _mm_set1_epi16(firValues[t]), sh, &p0, &p1);
+      s0 = _mm_add_epi32(s0, p0);
+      s1 = _mm_add_epi32(s1, p1);
+    }
+    _mm_storeu_si128((__m128i*)&dst[i], _mm_packs_epi32(s0, s1));
+  }
+#endif
+  for (; i < n; i++) {
+    int sum = 0;
+    for (int t = 0; t < 8; t++) {
+      sum += (x[i + t] * firValues[t]) >> 6;
+      if (t == 6)
+        sum = ((int16_t) (sum & 0xffff)); // clip 16-bit
+    }
+    dst[i] = sum < -0x8000 ? -0x8000 : (sum > 0x7fff ? 0x7fff : sum); // clamp 16-bit
+  }
+}
+
+// The echo for a block, same as dsp_handleEcho for each cycle. The echo
+// output is added to |mixL|/|mixR|. Work is split where the echo buffer index
+// wraps, since a cycle may read what an earlier cycle of the block wrote.
+static void dsp_echoBlock(Dsp* dsp, int16_t voiceOut[8][kDspBlockSize], int16_t* mixL, int16_t* mixR, int n) {
+  int16_t inL[kDspBlockSize], inR[kDspBlockSize];
+  int16_t sumL[kDspBlockSize], sumR[kDspBlockSize];
+  int16_t xL[7 + kDspBlockSize], xR[7 + kDspBlockSize];
+  int8_t volumeL[8], volumeR[8];
+
+  // echo input from the enabled channels
+  for (int ch = 0; ch < 8; ch++) {
+    volumeL[ch] = dsp->channel[ch].echoEnable ? dsp->channel[ch].volumeL : 0;
+    volumeR[ch] = dsp->channel[ch].echoEnable ? dsp->channel[ch].volumeR : 0;
+  }
+  dsp_sumVoices(voiceOut, volumeL, inL, n);
+  dsp_sumVoices(voiceOut, volumeR, inR, n);
+
+  for (int j = 0; j < 7; j++) {
+    xL[6 - j] = dsp->firBufferL[(dsp->firBufferIndex - 1 - j) & 7];
+    xR[6 - j] = dsp->firBufferR[(dsp->firBufferIndex - 1 - j) & 7];
+  }
+
+  for (int i = 0; i < n; ) {
+    int m = n - i < dsp->echoRemain ? n - i : dsp->echoRemain;
+    uint16_t adr = dsp->echoBufferAdr + dsp->echoBufferIndex * 4;
+    const uint8_t* ram = dsp->apu_ram;
+    for (int k = 0; k < m; k++, adr += 4) {
+      xL[7 + i + k] = (int16_t)(ram[adr] + (ram[(adr + 1) & 0xffff] << 8)) >> 1;
+      xR[7 + i + k] = (int16_t)(ram[(adr + 2) & 0xffff] + (ram[(adr + 3) & 0xffff] << 8)) >> 1;
+    }
+    dsp_firFilter(xL + i, dsp->firValues, sumL + i, m);
+    dsp_firFilter(xR + i, dsp->firValues, sumR + i, m);
+    dsp_addScaled(mixL + i, sumL + i, dsp->echoVolumeL, 7, m);
+    dsp_addScaled(mixR + i, sumR + i, dsp->echoVolumeR, 7, m);
+    if (dsp->echoWrites) {
+      dsp_addScaled(inL + i, sumL + i, dsp->feedbackVolume, 7, m);
+      dsp_addScaled(inR + i, sumR + i, dsp->feedbackVolume, 7, m);
+      adr = dsp->echoBufferAdr + dsp->echoBufferIndex * 4;
+      dsp_invalidateBrrCache(dsp, adr, m * 4);
+      for (int k = 0; k < m; k++, adr += 4) {
+        dsp->apu_ram[adr] = inL[i + k] & 0xfe;
+        dsp->apu_ram[(adr + 1) & 0xffff] = inL[i + k] >> 8;
+        dsp->apu_ram[(adr + 2) & 0xffff] = inR[i + k] & 0xfe;
+        dsp->apu_ram[(adr + 3) & 0xffff] = inR[i + k] >> 8;
+      }
+    }
+    i += m;
+    dsp->echoBufferIndex += m;
+    dsp->echoRemain -= m;
+    if(dsp->echoRemain == 0) {
+      dsp->echoRemain = dsp->echoDelay;
+      dsp->echoBufferIndex = 0;
+    }
+  }
+
+  for (int j = 0; j < 8; j++) {
+    dsp->firBufferL[(dsp->firBufferIndex + n - 1 - j) & 7] = xL[6 + n - j];
+    dsp->firBufferR[(dsp->firBufferIndex + n - 1 - j) & 7] = xR[6 + n - j];
+  }
+  dsp->firBufferIndex = (dsp->firBufferIndex + n) & 7;
+}
+
+// Everything rendering the voices of a block may change.
+typedef struct DspBlockSnapshot {
+  DspChannel channel[8];
+  uint8_t ram[0x80];
+  int16_t noiseSample;
+  uint16_t noiseCounter;
+} DspBlockSnapshot;
+
+// Renders |n| samples with the same result as calling dsp_cycle |n| times,
+// but one voice at a time over the whole block, followed by one mixing pass.
+// Voice state stays in DspChannel since it's part of snapshots.
+// Each cycle the echo writes to ram after all voices have decoded their BRR
+// data, so if a voice reads BRR data from the part of the echo buffer written
+// during the block, the block is undone and false is returned.
+static bool dsp_renderBlock(Dsp* dsp, int n) {
+  int16_t noise[kDspBlockSize];
+  int16_t voiceOut[8][kDspBlockSize];
+  int16_t mixL[kDspBlockSize], mixR[kDspBlockSize];
+  int8_t volumeL[8], volumeR[8];
+  DspBlockSnapshot snap;
+
+  if (dsp->echoWrites) {
+    memcpy(snap.channel, dsp->channel, sizeof(snap.channel));
+    memcpy(snap.ram, dsp->ram, sizeof(snap.ram));
+    snap.noiseSample = dsp->noiseSample;
+    snap.noiseCounter = dsp->noiseCounter;
+    if (n <= dsp->echoRemain) {
+      dsp->echoGuardStart = dsp->echoBufferAdr + dsp->echoBufferIndex * 4;
+      dsp->echoGuardLen = n * 4;
+    } else {
+      // the echo index wraps during the block, guard everything from the start
+      int len = dsp->echoBufferIndex + dsp->echoRemain;
+      if (len < dsp->echoDelay) len = dsp->echoDelay;
+      if (len > 0x4000) len = 0x4000;
+      dsp->echoGuardStart = dsp->echoBufferAdr;
+      dsp->echoGuardLen = len * 4;
+    }
+    dsp->echoGuardHit = false;
+  }
+
+  // the noise generator doesn't depend on the voices
+  for (int i = 0; i < n; i++) {
+    noise[i] = dsp->noiseSample;
+    dsp_handleNoise(dsp);
+  }
+  for (int ch = 0; ch < 8; ch++) {
+    for (int i = 0; i < n; i++)
+      voiceOut[ch][i] = dsp_cycleChannel(dsp, ch, ch > 0 ? voiceOut[ch - 1][i] : 0, noise[i]);
+    volumeL[ch] = dsp->channel[ch].volumeL;
+    volumeR[ch] = dsp->channel[ch].volumeR;
+  }
+
+  if (dsp->echoGuardLen != 0) {
+    dsp->echoGuardLen = 0;
+    if (dsp->echoGuardHit) {
+      memcpy(dsp->channel, snap.channel, sizeof(snap.channel));
+      memcpy(dsp->ram, snap.ram, sizeof(snap.ram));
+      dsp->noiseSample = snap.noiseSample;
+      dsp->noiseCounter = snap.noiseCounter;
+      return false;
+    }
+  }
+
+  dsp_mixVoices(voiceOut, volumeL, dsp->masterVolumeL, mixL, n);
+  dsp_mixVoices(voiceOut, volumeR, dsp->masterVolumeR, mixR, n);
+
+  dsp_echoBlock(dsp, voiceOut, mixL, mixR, n);
+
+  for (int i = 0; i < n && dsp->sampleOffset < 534; i++) {
+    dsp->sampleBuffer[dsp->sampleOffset * 2] = dsp->mute ? 0 : mixL[i];
+    dsp->sampleBuffer[dsp->sampleOffset * 2 + 1] = dsp->mute ? 0 : mixR[i];
+    dsp->sampleOffset++;
+  }
+  if (n & 1)
+    dsp->evenCycle = !dsp->evenCycle;
+  return true;
+}
+
+void dsp_cycleBlock(Dsp* dsp, int n) {
+#if MY_CHANGES
+  while (n > 0) {
+    int m = n < kDspBlockSize ? n : kDspBlockSize;
+    if (!dsp_renderBlock(dsp, m)) {
+      for (int i = 0; i < m; i++)
+        dsp_cycle(dsp);
+    }
+    n -= m;
+  }
+#else
+  // key on/off depends on evenCycle, which changes per sample
+  while (n-- > 0)
+    dsp_cycle(dsp);
+#endif
+}
+
+static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR, const int16_t* voiceOut, int stride) {
   // get value out of ram
   uint16_t adr = dsp->echoBufferAdr + dsp->echoBufferIndex * 4;
   dsp->firBufferL[dsp->firBufferIndex] = (
@@ -191,8 +464,8 @@ static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
   int inL = 0, inR = 0;
   for(int i = 0; i < 8; i++) {
     if(dsp->channel[i].echoEnable) {
-      inL += (dsp->channel[i].sampleOut * dsp->channel[i].volumeL) >> 6;
-      inR += (dsp->channel[i].sampleOut * dsp->channel[i].volumeR) >> 6;
+      inL += (voiceOut[i * stride] * dsp->channel[i].volumeL) >> 6;
+      inR += (voiceOut[i * stride] * dsp->channel[i].volumeR) >> 6;
       inL = inL < -0x8000 ? -0x8000 : (inL > 0x7fff ? 0x7fff : inL); // clamp 16-bit
       inR = inR < -0x8000 ? -0x8000 : (inR > 0x7fff ? 0x7fff : inR); // clamp 16-bit
     }
@@ -205,6 +478,7 @@ static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
   inL &= 0xfffe;
   inR &= 0xfffe;
   if(dsp->echoWrites) {
+    dsp_invalidateBrrCache(dsp, adr, 4);
     dsp->apu_ram[adr] = inL & 0xff;
     dsp->apu_ram[(adr + 1) & 0xffff] = inL >> 8;
     dsp->apu_ram[(adr + 2) & 0xffff] = inR & 0xff;
@@ -221,11 +495,12 @@ static void dsp_handleEcho(Dsp* dsp, int* outputL, int* outputR) {
   }
 }
 
-static void dsp_cycleChannel(Dsp* dsp, int ch) {
+// |prevOut| is this cycle's output of the previous channel, for pitch modulation.
+static inline int16_t dsp_cycleChannel(Dsp* dsp, int ch, int16_t prevOut, int16_t noiseSample) {
   // handle pitch counter
   uint16_t pitch = dsp->channel[ch].pitch;
   if(ch > 0 && dsp->channel[ch].pitchModulation) {
-    int factor = (dsp->channel[ch - 1].sampleOut >> 4) + 0x400;
+    int factor = (prevOut >> 4) + 0x400;
     pitch = (pitch * factor) >> 10;
     if(pitch > 0x3fff) pitch = 0x3fff;
   }
@@ -237,7 +512,7 @@ static void dsp_cycleChannel(Dsp* dsp, int ch) {
   dsp->channel[ch].pitchCounter = newCounter;
   int16_t sample = 0;
   if(dsp->channel[ch].useNoise) {
-    sample = dsp->noiseSample;
+    sample = noiseSample;
   } else {
     sample = dsp_getSample(dsp, ch, dsp->channel[ch].pitchCounter >> 12, (dsp->channel[ch].pitchCounter >> 4) & 0xff);
   }
@@ -281,6 +556,7 @@ static void dsp_cycleChannel(Dsp* dsp, int ch) {
   sample = (sample * dsp->channel[ch].gain) >> 11;
   dsp->ram[(ch << 4) | 9] = sample >> 7;
   dsp->channel[ch].sampleOut = sample;
+  return sample;
 }
 
 static void dsp_handleGain(Dsp* dsp, int ch) {
@@ -349,6 +625,18 @@ static int16_t dsp_getSample(Dsp* dsp, int ch, int sampleNum, int offset) {
   return out >> 1;
 }
 
+static inline bool dsp_inEchoGuard(Dsp* dsp, uint16_t adr, int len) {
+  return (uint16_t)(adr - dsp->echoGuardStart) < dsp->echoGuardLen ||
+         (uint16_t)(dsp->echoGuardStart - adr) < len;
+}
+
+static inline bool dsp_inEchoBuffer(Dsp* dsp, uint16_t adr, int len) {
+  return dsp->echoWrites && ((uint16_t)(adr - dsp->echoBufferAdr) < dsp->echoDelay * 4 ||
+                             (uint16_t)(dsp->echoBufferAdr - adr) < len);
+}
+
+// Decodes the next brr block of a channel, or copies it from the cache when
+// the same block was decoded before with the same previous samples.
 static void dsp_decodeBrr(Dsp* dsp, int ch) {
   // copy last 3 samples (16-18) to first 3 for interpolation
   dsp->channel[ch].decodeBuffer[0] = dsp->channel[ch].decodeBuffer[16];
@@ -358,6 +646,8 @@ static void dsp_decodeBrr(Dsp* dsp, int ch) {
   if(dsp->channel[ch].previousFlags == 1 || dsp->channel[ch].previousFlags == 3) {
     // loop sample
     uint16_t samplePointer = dsp->dirPage + 4 * dsp->channel[ch].srcn;
+    if(dsp->echoGuardLen != 0 && dsp_inEchoGuard(dsp, samplePointer + 2, 2))
+      dsp->echoGuardHit = true;
     dsp->channel[ch].decodeOffset = dsp->apu_ram[(samplePointer + 2) & 0xffff];
     dsp->channel[ch].decodeOffset |= (dsp->apu_ram[(samplePointer + 3) & 0xffff]) << 8;
     if(dsp->channel[ch].previousFlags == 1) {
@@ -367,40 +657,65 @@ static void dsp_decodeBrr(Dsp* dsp, int ch) {
     }
     dsp->ram[ENDX] |= 1 << ch; // set ENDX bit for channel
   }
-  uint8_t header = dsp->apu_ram[dsp->channel[ch].decodeOffset++];
+  if(dsp->echoGuardLen != 0 && dsp_inEchoGuard(dsp, dsp->channel[ch].decodeOffset, 9))
+    dsp->echoGuardHit = true;
+  uint16_t adr = dsp->channel[ch].decodeOffset;
+  uint8_t header = dsp->apu_ram[adr];
   int shift = header >> 4;
   int filter = (header & 0xc) >> 2;
   dsp->channel[ch].previousFlags = header & 0x3;
-  uint8_t curByte = 0;
-  int old = dsp->channel[ch].old;
-  int older = dsp->channel[ch].older;
-  for(int i = 0; i < 16; i++) {
-    int s = 0;
-    if(i & 1) {
-      s = curByte & 0xf;
-    } else {
-      curByte = dsp->apu_ram[dsp->channel[ch].decodeOffset++];
-      s = curByte >> 4;
-    }
-    if(s > 7) s -= 16;
-    if(shift <= 0xc) {
-      s = (s << shift) >> 1;
-    } else {
-      s = (s >> 3) << 12;
+  dsp->channel[ch].decodeOffset = adr + 9;
+  // only the previous samples that the filter uses are part of the key
+  int old = filter >= 1 ? dsp->channel[ch].old : 0;
+  int older = filter >= 2 ? dsp->channel[ch].older : 0;
+  uint32_t hash = (adr | (uint32_t)(uint16_t)old << 16) * 0x9e3779b1u ^ (uint16_t)older * 0x85ebca6bu;
+  DspBrrCacheEntry* e = &dsp->brrCache[(hash >> 16) & (kDspBrrCacheSize - 1)];
+  int16_t* out = dsp->channel[ch].decodeBuffer + 3;
+  if(e->generation == dsp->brrCacheGeneration && e->adr == adr && e->old == old && e->older == older) {
+    memcpy(out, e->samples, sizeof(e->samples));
+    dsp->brrCacheHits++;
+  } else {
+    uint8_t curByte = 0;
+    uint16_t byteAdr = adr + 1;
+    for(int i = 0; i < 16; i++) {
+      int s = 0;
+      if(i & 1) {
+        s = curByte & 0xf;
+      } else {
+        curByte = dsp->apu_ram[byteAdr++];
+        s = curByte >> 4;
+      }
+      if(s > 7) s -= 16;
+      if(shift <= 0xc) {
+        s = (s << shift) >> 1;
+      } else {
+        s = (s >> 3) << 12;
+      }
+      switch(filter) {
+        case 1: s += old + (-old >> 4); break;
+        case 2: s += 2 * old + ((3 * -old) >> 5) - older + (older >> 4); break;
+        case 3: s += 2 * old + ((13 * -old) >> 6) - older + ((3 * older) >> 4); break;
+      }
+      s = s < -0x8000 ? -0x8000 : (s > 0x7fff ? 0x7fff : s); // clamp 16-bit
+      s = ((int16_t) ((s & 0x7fff) << 1)) >> 1; // clip 15-bit
+      older = old;
+      old = s;
+      out[i] = s;
     }
-    switch(filter) {
-      case 1: s += old + (-old >> 4); break;
-      case 2: s += 2 * old + ((3 * -old) >> 5) - older + (older >> 4); break;
-      case 3: s += 2 * old + ((13 * -old) >> 6) - older + ((3 * older) >> 4); break;
+    dsp->brrCacheMisses++;
+    // blocks in the echo buffer would be invalidated right away
+    if(!dsp_inEchoBuffer(dsp, adr, 9)) {
+      e->generation = dsp->brrCacheGeneration;
+      e->adr = adr;
+      e->old = filter >= 1 ? dsp->channel[ch].old : 0;
+      e->older = filter >= 2 ? dsp->channel[ch].older : 0;
+      memcpy(e->samples, out, sizeof(e->samples));
+      dsp->brrCachePages[adr >> 8] = 1;
+      dsp->brrCachePages[(uint16_t)(adr + 8) >> 8] = 1;
     }
-    s = s < -0x8000 ? -0x8000 : (s > 0x7fff ? 0x7fff : s); // clamp 16-bit
-    s = ((int16_t) ((s & 0x7fff) << 1)) >> 1; // clip 15-bit
-    older = old;
-    old = s;
-    dsp->channel[ch].decodeBuffer[i + 3] = s;
-  }
-  dsp->channel[ch].older = older;
-  dsp->channel[ch].old = old;
+  }
+  dsp->channel[ch].older = out[14];
+  dsp->channel[ch].old = out[15];
 }
 
 static void dsp_handleNoise(Dsp* dsp) {
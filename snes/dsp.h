@@ -46,8 +46,27 @@ typedef struct DspChannel {
   bool echoEnable;
 } DspChannel;
 
+// A decoded brr block, keyed by its address and the two samples before it.
+typedef struct DspBrrCacheEntry {
+  uint32_t generation; // 0 for unused
+  uint16_t adr;
+  int16_t old;
+  int16_t older;
+  int16_t samples[16];
+} DspBrrCacheEntry;
+
 struct Dsp {
   uint8_t *apu_ram;
+  // decoded brr blocks (not saved), entries from older generations are stale
+  DspBrrCacheEntry *brrCache;
+  uint32_t brrCacheGeneration;
+  uint32_t brrCacheHits;
+  uint32_t brrCacheMisses;
+  uint8_t brrCachePages[256]; // apu ram pages that cached blocks were read from
+  // echo buffer range written during the current block (not saved)
+  uint16_t echoGuardStart;
+  uint32_t echoGuardLen;
+  bool echoGuardHit;
   // mirror ram
   uint8_t ram[0x80];
   // 8 channels
@@ -92,9 +111,12 @@ Dsp* dsp_init(uint8_t *apu_ram);
 void dsp_free(Dsp* dsp);
 void dsp_reset(Dsp* dsp);
 void dsp_cycle(Dsp* dsp);
+void dsp_cycleBlock(Dsp* dsp, int n);
 uint8_t dsp_read(Dsp* dsp, uint8_t adr);
 void dsp_write(Dsp* dsp, uint8_t adr, uint8_t val);
 void dsp_getSamples(Dsp* dsp, int16_t* sampleData, int samplesPerFrame, int numChannels);
 void dsp_saveload(Dsp *dsp, SaveLoadFunc *func, void *ctx);
+// Must be called when apu ram is written other than by the dsp itself.
+void dsp_invalidateBrrCache(Dsp* dsp, uint16_t adr, uint32_t len);
 
 #endif
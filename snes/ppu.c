@@ -21,6 +21,7 @@ static int ppu_getPixelForMode7(Ppu* ppu, int x, int layer, bool priority);
 static bool ppu_getWindowState(Ppu* ppu, int layer, int x);
 static bool ppu_evaluateSprites(Ppu* ppu, int line);
 static void PpuDrawWholeLine(Ppu *ppu, uint y);
+static void PpuWriteObservationLine(Ppu *ppu, uint row);
 
 #define IS_SCREEN_ENABLED(ppu, sub, layer) (ppu->screenEnabled[sub] & (1 << layer))
 #define IS_SCREEN_WINDOWED(ppu, sub, layer) (ppu->screenWindowed[sub] & (1 << layer))
@@ -139,7 +140,28 @@ int PpuGetCurrentRenderScale(Ppu *ppu, uint32_t render_flags) {
   return hq ? 4 : 1;
 }
 
+void PpuSetObservationTarget(Ppu *ppu, uint8_t *pixels, int width, int height, int channels) {
+  ppu->obsPixels = pixels;
+  ppu->obsChannels = channels;
+  if (ppu->obsWidth == width && ppu->obsHeight == height)
+    return;
+  ppu->obsWidth = width;
+  ppu->obsHeight = height;
+  // Sample the middle of each output pixel.
+  memset(ppu->obsRowForLine, 0, sizeof(ppu->obsRowForLine));
+  for (int y = 0; y < height; y++)
+    ppu->obsRowForLine[(2 * y + 1) * 224 / (2 * height)] = y + 1;
+  for (int x = 0; x < width; x++)
+    ppu->obsColumnOffs[x] = (2 * x + 1) * 256 / (2 * width) * 4;
+}
+
 void PpuBeginDrawing(Ppu *ppu, uint8_t *pixels, size_t pitch, uint32_t render_flags) {
+  // Observation lines all go to the same scratch line, without the extras.
+  if (render_flags & kPpuRenderFlags_Observation) {
+    render_flags &= ~(kPpuRenderFlags_4x4Mode7 | kPpuRenderFlags_Height240);
+    pixels = (uint8 *)ppu->obsLine;
+    pitch = 0;
+  }
   ppu->renderFlags = render_flags;
   ppu->renderPitch = (uint)pitch;
   ppu->renderBuffer = pixels;
@@ -171,6 +193,12 @@ static inline void ClearBackdrop(PpuPixelPrioBufs *buf) {
 
 void ppu_runLine(Ppu *ppu, int line) {
   if(line != 0) {
+    uint obs_row = 0;
+    if (ppu->renderFlags & kPpuRenderFlags_Observation) {
+      obs_row = line <= 224 ? ppu->obsRowForLine[line - 1] : 0;
+      if (obs_row == 0)
+        return;
+    }
     if (ppu->mosaicSize != ppu->lastMosaicModulo) {
       int mod = ppu->mosaicSize;
       ppu->lastMosaicModulo = mod;
@@ -203,6 +231,27 @@ void ppu_runLine(Ppu *ppu, int line) {
         memset(dst + sizeof(uint32) * (256 + ppu->extraLeftRight), 0, sizeof(uint32) * ppu->extraLeftRight);
       }
     }
+    if (obs_row != 0)
+      PpuWriteObservationLine(ppu, obs_row - 1);
+  }
+}
+
+static void PpuWriteObservationLine(Ppu *ppu, uint row) {
+  const uint8 *src = (const uint8 *)&ppu->obsLine[ppu->extraLeftRight];
+  uint8 *dst = ppu->obsPixels + row * ppu->obsWidth * ppu->obsChannels;
+  const uint16 *offs = ppu->obsColumnOffs;
+  if (ppu->obsChannels == 1) {
+    for (uint x = 0; x < ppu->obsWidth; x++) {
+      const uint8 *p = src + offs[x];
+      dst[x] = (p[2] * 77 + p[1] * 150 + p[0] * 29) >> 8;
+    }
+  } else {
+    for (uint x = 0; x < ppu->obsWidth; x++, dst += 3) {
+      const uint8 *p = src + offs[x];
+      dst[0] = p[2];
+      dst[1] = p[1];
+      dst[2] = p[0];
+    }
   }
 }
 
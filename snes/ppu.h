@@ -48,6 +48,8 @@ enum {
   kPpuRenderFlags_Height240 = 4,
   // Disable sprite render limits
   kPpuRenderFlags_NoSpriteLimits = 8,
+  // Write a small frame to the target of PpuSetObservationTarget instead
+  kPpuRenderFlags_Observation = 16,
 };
 
 
@@ -61,6 +63,15 @@ struct Ppu {
   uint8_t extraLeftCur, extraRightCur, extraLeftRight, extraBottomCur;
   float mode7PerspectiveLow, mode7PerspectiveHigh;
 
+  // Observation target. Lines that map to a row of it get drawn into obsLine
+  // and then sampled down, the others are skipped.
+  uint8_t *obsPixels;
+  uint16_t obsWidth, obsHeight;
+  uint8_t obsChannels;
+  uint8_t obsRowForLine[224];  // row + 1, or 0 if not sampled
+  uint16_t obsColumnOffs[256];
+  uint32_t obsLine[kPpuXPixels];
+
   // TMW / TSW etc
   uint8 screenEnabled[2];
   uint8 screenWindowed[2];
@@ -144,6 +155,10 @@ uint8_t ppu_read(Ppu* ppu, uint8_t adr);
 void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val);
 void ppu_saveload(Ppu *ppu, SaveLoadFunc *func, void *ctx);
 void PpuBeginDrawing(Ppu *ppu, uint8_t *buffer, size_t pitch, uint32_t render_flags);
+// Where draws with kPpuRenderFlags_Observation go. The frame is |width| x
+// |height| with 1 (gray) or 3 (RGB) bytes per pixel, at most 256x224, and
+// gets nearest neighbor sampled from the 256x224 picture.
+void PpuSetObservationTarget(Ppu *ppu, uint8_t *pixels, int width, int height, int channels);
 void PpuClearHostSpriteMetadata(Ppu *ppu);
 void PpuSetHostSpriteFlags(Ppu *ppu, int sprite_index, uint8_t flags);
 
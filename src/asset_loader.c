@@ -0,0 +1,212 @@
+#include "asset_loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "assets.h"
+#include "config.h"
+#include "features.h"
+#include "util.h"
+
+const uint8 *g_asset_ptrs[kNumberOfAssets];
+uint32 g_asset_sizes[kNumberOfAssets];
+static uint8 *g_asset_copies[kNumberOfAssets];
+const char *g_assets_source;
+
+// The assets are mapped read only so all instances share them. Assets that
+// get patched at startup get a private copy first.
+void *MakeAssetWritable(const void *asset) {
+  for (size_t i = 0; i < kNumberOfAssets; i++) {
+    if (g_asset_ptrs[i] != asset || g_asset_sizes[i] == 0)
+      continue;
+    if (!g_asset_copies[i]) {
+      g_asset_copies[i] = malloc(g_asset_sizes[i]);
+      if (!g_asset_copies[i])
+        Die("Out of memory");
+      memcpy(g_asset_copies[i], g_asset_ptrs[i], g_asset_sizes[i]);
+      g_asset_ptrs[i] = g_asset_copies[i];
+    }
+    return g_asset_copies[i];
+  }
+  Die("MakeAssetWritable: Not an asset");
+}
+
+// Patches zelda3.sfc with zelda3_assets.bps. The result is saved to a file
+// named after the crcs in the patch, so later launches can just map it.
+static const uint8 *LoadAssetsFromBps(size_t *length) {
+  size_t bps_length, bps_src_length;
+  uint8 *bps, *bps_src;
+  bps = ReadWholeFile("zelda3_assets.bps", &bps_length);
+  if (!bps)
+    Die("Failed to read zelda3_assets.dat. Please see the README for information about how you get this file.");
+  if (bps_length < 16)
+    Die("Invalid zelda3_assets.bps");
+  // The patch ends with the crcs of the source, the target and the patch itself.
+  char cache_name[64];
+  snprintf(cache_name, sizeof(cache_name), "zelda3_assets_%08x_%08x.cache",
+           DWORD(bps[bps_length - 12]), DWORD(bps[bps_length - 4]));
+  const uint8 *data = MapWholeFile(cache_name, length);
+  if (data) {
+    free(bps);
+    g_assets_source = "bps cache";
+    return data;
+  }
+  bps_src = ReadWholeFile("zelda3.sfc", &bps_src_length);
+  if (!bps_src)
+    Die("Missing file: zelda3.sfc");
+  uint8 *patched = ApplyBps(bps_src, bps_src_length, bps, bps_length, length);
+  if (!patched)
+    Die("Unable to apply zelda3_assets.bps. Please make sure you got the right version of 'zelda3.sfc'");
+  free(bps);
+  free(bps_src);
+
+  // Write to a temporary name first so other instances never see half a file.
+  char tmp_name[80];
+  snprintf(tmp_name, sizeof(tmp_name), "%s.%d", cache_name, (int)getpid());
+  FILE *f = fopen(tmp_name, "wb");
+  bool written = f && fwrite(patched, 1, *length, f) == *length;
+  if (f && fclose(f) != 0)
+    written = false;
+  if (written && rename(tmp_name, cache_name) == 0 && (data = MapWholeFile(cache_name, length)) != NULL) {
+    free(patched);
+    g_assets_source = "bps, cached";
+    return data;
+  }
+  remove(tmp_name);
+  fprintf(stderr, "Warning: Unable to write %s\n", cache_name);
+  g_assets_source = "bps";
+  return patched;
+}
+
+// Version 2 of the assets file, see write_assets_v2 in compile_resources.py.
+static const char kAssetsV2Magic[16] = "Zelda3_v2     \n";
+enum {
+  kAssetCompression_None = 0,
+  kAssetCompression_Lz4 = 1,
+  kAssetFlag_Packed = 0x100,
+};
+
+static bool g_assets_v2;
+static uint32 g_asset_flags[kNumberOfAssets];
+static const uint8 *g_asset_stored[kNumberOfAssets];
+static uint32 g_asset_stored_sizes[kNumberOfAssets];
+
+static void LoadAssetsV2(const uint8 *data, size_t length) {
+  uint32 key_sig_size = *(uint32 *)(data + 84);
+  if (96 + kNumberOfAssets * 16 + (uint64)key_sig_size > length)
+    Die("Assets file corruption");
+
+  for (size_t i = 0; i < kNumberOfAssets; i++) {
+    const uint32 *t = (const uint32 *)(data + 96 + i * 16);
+    uint32 offset = t[0], size = t[1], stored_size = t[2], flags = t[3];
+    if ((uint64)offset + stored_size > length)
+      Die("Assets file corruption");
+    g_asset_sizes[i] = size;
+    g_asset_flags[i] = flags;
+    if ((flags & 0xff) == kAssetCompression_None) {
+      if (stored_size != size)
+        Die("Assets file corruption");
+      g_asset_ptrs[i] = data + offset;
+    } else if ((flags & 0xff) == kAssetCompression_Lz4 && (flags & kAssetFlag_Packed)) {
+      // Only reachable through FindInAssetArray, which decodes it.
+      g_asset_ptrs[i] = NULL;
+      g_asset_stored[i] = data + offset;
+      g_asset_stored_sizes[i] = stored_size;
+    } else {
+      Die("Unsupported asset compression");
+    }
+  }
+  g_assets_v2 = true;
+}
+
+// Compressed assets are decoded the first time they're looked up. Racing
+// threads may both decode, only one result is kept.
+static const uint8 *GetAssetData(int asset) {
+  const uint8 *data = SDL_AtomicGetPtr((void **)&g_asset_ptrs[asset]);
+  if (data || !g_asset_stored[asset])
+    return data;
+  uint8 *buf = malloc(g_asset_sizes[asset]);
+  if (!buf)
+    Die("Out of memory");
+  if (Lz4Decompress(g_asset_stored[asset], g_asset_stored_sizes[asset], buf, g_asset_sizes[asset]) != g_asset_sizes[asset])
+    Die("Unable to decompress asset");
+  if (!SDL_AtomicCASPtr((void **)&g_asset_ptrs[asset], NULL, buf))
+    free(buf);
+  return SDL_AtomicGetPtr((void **)&g_asset_ptrs[asset]);
+}
+
+void LoadAssets(const char *filename) {
+  size_t length = 0;
+  const uint8 *data = MapWholeFile(filename, &length);
+  g_assets_source = "mapped";
+  if (!data)
+    data = LoadAssetsFromBps(&length);
+
+  static const char kAssetsSig[] = { kAssets_Sig };
+  bool v2 = length >= 16 && memcmp(data, kAssetsV2Magic, 16) == 0;
+  size_t header_size = v2 ? 96 + kNumberOfAssets * 16 : 88 + kNumberOfAssets * 4;
+
+  // Both versions start with the hash of the asset names.
+  if (length < header_size ||
+      memcmp(data + (v2 ? 16 : 0), kAssetsSig + (v2 ? 16 : 0), v2 ? 32 : 48) != 0 ||
+      *(uint32*)(data + 80) != kNumberOfAssets)
+    Die("Invalid assets file");
+
+  if (v2) {
+    LoadAssetsV2(data, length);
+  } else {
+    uint32 offset = 88 + kNumberOfAssets * 4 + *(uint32 *)(data + 84);
+
+    for (size_t i = 0; i < kNumberOfAssets; i++) {
+      uint32 size = *(uint32 *)(data + 88 + i * 4);
+      offset = (offset + 3) & ~3;
+      if ((uint64)offset + size > length)
+        Die("Assets file corruption");
+      g_asset_sizes[i] = size;
+      g_asset_ptrs[i] = data + offset;
+      offset += size;
+    }
+  }
+
+  if (g_config.features0 & kFeatures0_DimFlashes) { // patch dungeon floor palettes
+    uint16 *pal = MakeAssetWritable(kPalette_DungBgMain);
+    pal[0x484] = 0x70;
+    pal[0x485] = 0x95;
+    pal[0x486] = 0x57;
+  }
+}
+
+size_t GetPrivateAssetBytes() {
+  size_t copied = 0;
+  for (size_t i = 0; i < kNumberOfAssets; i++)
+    copied += g_asset_copies[i] ? g_asset_sizes[i] : 0;
+  return copied;
+}
+
+MemBlk FindInAssetArray(int asset, int idx) {
+  return FindIndexInMemblk((MemBlk) { GetAssetData(asset), g_asset_sizes[asset] }, idx);
+}
+
+// Prints how the assets were loaded and, for the packed assets of a v2 file,
+// the time to decode them.
+void RunAssetBenchmark() {
+  printf("Assets: %s, %s container\n", g_assets_source, g_assets_v2 ? "v2" : "v1");
+  if (!g_assets_v2)
+    return;
+  double freq = (double)SDL_GetPerformanceFrequency();
+  for (int asset = 0; asset < kNumberOfAssets; asset++) {
+    if (!(g_asset_flags[asset] & kAssetFlag_Packed))
+      continue;
+    uint64 t0 = SDL_GetPerformanceCounter();
+    GetAssetData(asset);
+    uint64 t1 = SDL_GetPerformanceCounter();
+    printf("asset %2d: %8u bytes, %7u stored, decode %.3f ms\n",
+           asset, g_asset_sizes[asset], g_asset_stored[asset] ? g_asset_stored_sizes[asset] : g_asset_sizes[asset],
+           (t1 - t0) * 1000.0 / freq);
+  }
+}
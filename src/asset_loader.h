@@ -0,0 +1,16 @@
+#ifndef ZELDA3_ASSET_LOADER_H_
+#define ZELDA3_ASSET_LOADER_H_
+
+#include "types.h"
+
+// Maps the assets file and points g_asset_ptrs into it. When the file is
+// missing, zelda3_assets.bps gets applied to zelda3.sfc instead.
+void LoadAssets(const char *filename);
+// Returns a private copy of the asset that can be patched.
+void *MakeAssetWritable(const void *asset);
+size_t GetPrivateAssetBytes();
+void RunAssetBenchmark();
+
+extern const char *g_assets_source;
+
+#endif  // ZELDA3_ASSET_LOADER_H_
@@ -1,4 +1,5 @@
 #include "audio.h"
+#include <SDL.h>
 #include "zelda_rtl.h"
 #include "variables.h"
 #include "features.h"
@@ -7,6 +8,8 @@
 #include "third_party/opus-1.3.1-stripped/opus.h"
 #include "config.h"
 #include "assets.h"
+#include "resampler.h"
+#include "util.h"
 
 // This needs to hold a lot more things than with just PCM
 typedef struct MsuPlayerResumeInfo {
@@ -26,22 +29,115 @@ enum {
   kMsuState_Playing = 3,
 };
 
-typedef struct MsuPlayer {
-  FILE *f;
-  uint32 buffer_size, buffer_pos;
+// MSU files are read and decoded by a worker thread that keeps a few hundred
+// ms of PCM buffered ahead in a ring, so the mixer never waits on the disk
+// or the opus decoder. Each decoded packet also queues a marker with the
+// resume info that becomes current once the mixer reaches that packet.
+enum {
+  kMsuRingFrames = 16384,
+  kMsuRingMarkers = 64,
+  kMsuReadAheadFrames = 14400,  // 300ms at 48kHz
+  kMsuMaxTracks = 256,
+};
+
+enum {
+  kMsuMarker_Packet = 0,
+  kMsuMarker_Finished = 1,
+  kMsuMarker_Error = 2,
+};
+
+typedef struct MsuMarker {
+  uint32 pos;
+  uint8 kind;
+  MsuPlayerResumeInfo resume_info;
+} MsuMarker;
+
+enum {
+  kMsuTrack_Unknown = 0,
+  kMsuTrack_Missing = 1,
+  kMsuTrack_Present = 2,
+};
+
+typedef struct MsuTrackHeader {
+  uint8 status;
+  uint32 tag, repeat_position;
+} MsuTrackHeader;
+
+// A request from the game to the worker. track == 0 stops playback.
+typedef struct MsuCommand {
+  uint32 generation;
+  uint8 track, hint_track;
+  bool resuming;
+  MsuPlayerResumeInfo resume_info;
+} MsuCommand;
+
+// Recently played tracks stay mapped together with their opus decoder, so
+// going back to one, typically the overworld after a house or a cave,
+// doesn't touch the disk.
+enum {
+  kMsuTrackCacheSize = 4,
+};
+
+typedef struct MsuCachedTrack {
+  uint8 track;
+  uint32 last_used;
+  const uint8 *data;
+  size_t size;
+  OpusDecoder *opus;
+} MsuCachedTrack;
+
+typedef struct MsuStats {
+  uint32 hits, misses, preloads;
+  uint64 hit_ticks, miss_ticks;
+} MsuStats;
+
+// Owned by the worker thread.
+typedef struct MsuDecoder {
+  MsuCachedTrack *cur;
+  const uint8 *data;
+  size_t size, pos;
+  bool is_opuz, resuming;
   uint32 preskip, samples_until_repeat;
   uint32 total_samples_in_file, repeat_position;
   uint32 cur_file_offs;
+  uint16 range_cur, range_repeat;
+  MsuPlayerResumeInfo resume_info;
+  MsuCachedTrack cache[kMsuTrackCacheSize];
+  uint32 cache_clock;
+  uint16 next_scan_track;
+  MsuStats stats;
+  int16 buffer[960 * 2];
+} MsuDecoder;
+
+typedef struct MsuPlayer {
   MsuPlayerResumeInfo resume_info;
   uint8 enabled;
   uint8 state;
   float volume, volume_step, volume_target;
-  uint16 range_cur, range_repeat;
-  OpusDecoder *opus;
-  int16 buffer[960 * 2];
+  Resampler resampler;
+  // Consumer side, protected by the apu lock.
+  uint32 generation;
+  bool synced;
+  // Wait for the worker instead of underrunning, for offline rendering.
+  bool synchronous;
+  // Shared with the worker.
+  SDL_Thread *thread;
+  SDL_mutex *mutex;
+  SDL_cond *cond;
+  MsuCommand command;
+  bool has_command, quit;
+  MsuTrackHeader headers[kMsuMaxTracks];
+  uint32 ring_start, marker_start;  // valid once ring_generation is set
+  SDL_atomic_t ring_generation;
+  SDL_atomic_t write_pos, read_pos, marker_write, marker_read;
+  MsuMarker markers[kMsuRingMarkers];
+  int16 ring[kMsuRingFrames * 2];
 } MsuPlayer;
 
 static MsuPlayer g_msu_player;
+static MsuDecoder g_msu_decoder;
+static Resampler g_dsp_resampler;
+static uint32 g_audio_out_freq;
 
 static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snapshot);
 
@@ -157,17 +253,65 @@ void ZeldaPlayMsuAudioTrack(uint8 music_ctrl) {
   ZeldaApuUnlock();
 }
 
+static void MsuPlayer_PostCommand(MsuPlayer *mp, uint8 track, uint8 hint_track, bool resuming) {
+  mp->synced = false;
+  SDL_LockMutex(mp->mutex);
+  mp->command.generation = ++mp->generation;
+  mp->command.track = track;
+  mp->command.hint_track = hint_track;
+  mp->command.resuming = resuming;
+  mp->command.resume_info = mp->resume_info;
+  mp->has_command = true;
+  SDL_CondSignal(mp->cond);
+  SDL_UnlockMutex(mp->mutex);
+}
+
+// The worker stops by itself at the end of a track or on errors, the next
+// command takes care of any other case.
 static void MsuPlayer_CloseFile(MsuPlayer *mp) {
-  if (mp->f)
-    fclose(mp->f);
-  opus_decoder_destroy(mp->opus);
-  mp->opus = NULL;
-  mp->f = NULL;
+  mp->synced = false;
   if (mp->state != kMsuState_FinishedPlaying)
     mp->state = kMsuState_Idle;
   memset(&mp->resume_info, 0, sizeof(mp->resume_info));
 }
 
+static void MsuPlayer_GetFileName(MsuPlayer *mp, int track, char *fname, size_t size) {
+  snprintf(fname, size, "%s%d.%s", g_config.msu_path ? g_config.msu_path : "", track, mp->enabled & kMsuEnabled_Opuz ? "opuz" : "pcm");
+}
+
+static void MsuPlayer_ReadTrackHeader(MsuPlayer *mp, int track, MsuTrackHeader *h) {
+  char fname[256];
+  size_t size;
+  MsuPlayer_GetFileName(mp, track, fname, sizeof(fname));
+  const uint8 *data = MapWholeFile(fname, &size);
+  h->status = kMsuTrack_Missing;
+  if (data) {
+    if (size >= 8) {
+      h->tag = *(uint32 *)(data + 0);
+      h->repeat_position = *(uint32 *)(data + 4);
+      if (h->tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O') || h->tag == (('1' << 24) | ('U' << 16) | ('S' << 8) | 'M'))
+        h->status = kMsuTrack_Present;
+    }
+    UnmapWholeFile(data, size);
+  }
+}
+
+// The worker fills in the headers of all tracks in the background. Until it
+// got to a track, the header gets read right here.
+static MsuTrackHeader MsuPlayer_GetTrackHeader(MsuPlayer *mp, int track) {
+  MsuTrackHeader h;
+  SDL_LockMutex(mp->mutex);
+  h = mp->headers[track];
+  SDL_UnlockMutex(mp->mutex);
+  if (h.status == kMsuTrack_Unknown) {
+    MsuPlayer_ReadTrackHeader(mp, track, &h);
+    SDL_LockMutex(mp->mutex);
+    mp->headers[track] = h;
+    SDL_UnlockMutex(mp->mutex);
+  }
+  return h;
+}
+
 static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snapshot) {
   MsuPlayerResumeInfo resume;
   int actual_track = RemapMsuDeluxeTrack(mp, orig_track);
@@ -188,24 +332,25 @@ static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snaps
   mp->volume_target = kVolumeTransitionTargetFloat[3];
   mp->volume_step = kVolumeTransitionStepFloat[3];
 
-  mp->state = kMsuState_Idle;
+  bool was_playing = (mp->state >= kMsuState_Resuming);
   MsuPlayer_CloseFile(mp);
-  if (actual_track == 0)
-    return;
-  char fname[256], buf[8];
-  snprintf(fname, sizeof(fname), "%s%d.%s", g_config.msu_path ? g_config.msu_path : "", actual_track, mp->enabled & kMsuEnabled_Opuz ? "opuz" : "pcm");
-  printf("Loading MSU %s\n", fname);
-  mp->f = fopen(fname, "rb");
-  if (mp->f == NULL)
-    goto READ_ERROR;
-  setvbuf(mp->f, NULL, _IOFBF, 16384);
-  if (fread(buf, 1, 8, mp->f) != 8) READ_ERROR: {
-    fprintf(stderr, "Unable to read MSU file %s\n", fname);
-    MsuPlayer_CloseFile(mp);
+  mp->state = kMsuState_Idle;
+  MsuTrackHeader header = { 0 };
+  if (actual_track != 0 && actual_track < kMsuMaxTracks) {
+    header = MsuPlayer_GetTrackHeader(mp, actual_track);
+    if (header.status != kMsuTrack_Present) {
+      char fname[256];
+      MsuPlayer_GetFileName(mp, actual_track, fname, sizeof(fname));
+      fprintf(stderr, "Unable to read MSU file %s\n", fname);
+    }
+  }
+  if (header.status != kMsuTrack_Present) {
+    if (was_playing)
+      MsuPlayer_PostCommand(mp, 0, 0, false);
     return;
   }
-  uint32 file_tag = *(uint32 *)(buf + 0);
-  mp->repeat_position = *(uint32 *)(buf + 4);
+  printf("Loading MSU track %d\n", actual_track);
+  uint32 file_tag = header.tag;
   mp->state = (resume.actual_track == actual_track && resume.tag == file_tag) ? kMsuState_Resuming : kMsuState_Playing;
   if (mp->state == kMsuState_Resuming) {
     memcpy(&mp->resume_info, &resume, sizeof(mp->resume_info));
@@ -215,26 +360,274 @@ static void MsuPlayer_Open(MsuPlayer *mp, int orig_track, bool resume_from_snaps
     mp->resume_info.tag = file_tag;
     mp->resume_info.range_cur = 8;
   }
-  mp->cur_file_offs = mp->resume_info.offset;
-  mp->samples_until_repeat = mp->resume_info.samples_until_repeat;
-  mp->range_cur = mp->resume_info.range_cur;
-  mp->range_repeat = mp->resume_info.range_repeat;
-  mp->buffer_size = mp->buffer_pos = 0;
-  mp->preskip = 0;
-  if (file_tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O')) {
-    mp->opus = opus_decoder_create(48000, 2, NULL);
-    if (!mp->opus)
-      goto READ_ERROR;
-    if (mp->state == kMsuState_Resuming)
-      fseek(mp->f, mp->cur_file_offs, SEEK_SET);
-  } else if (file_tag == (('1' << 24) | ('U' << 16) | ('S' << 8) | 'M')) {
-    fseek(mp->f, 0, SEEK_END);
-    mp->total_samples_in_file = (ftell(mp->f) - 8) / 4;
-    mp->samples_until_repeat = mp->total_samples_in_file - mp->cur_file_offs;
-    fseek(mp->f, mp->cur_file_offs * 4 + 8, SEEK_SET);
+  bool is_opuz = (file_tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O'));
+  Resampler_Init(&mp->resampler, g_config.resampler_quality, is_opuz ? 48000 : 44100,
+                 g_audio_out_freq ? g_audio_out_freq : g_config.audio_freq);
+  // Leaving for a dungeon or house likely means going back to this track
+  // later, so have the worker open it ahead of time.
+  uint8 hint_track = ((MsuPlayerResumeInfo *)msu_resume_info_alt)->actual_track;
+  MsuPlayer_PostCommand(mp, actual_track, hint_track, mp->state == kMsuState_Resuming);
+}
+
+static void MsuDecoder_Close(MsuDecoder *d) {
+  d->cur = NULL;
+  d->data = NULL;
+  d->size = d->pos = 0;
+}
+
+static bool MsuDecoder_Read(MsuDecoder *d, void *dst, size_t n) {
+  if (d->size - d->pos < n)
+    return false;
+  memcpy(dst, d->data + d->pos, n);
+  d->pos += n;
+  return true;
+}
+
+// Returns the track from the cache, mapping it in place of the least
+// recently used one if needed.
+static MsuCachedTrack *MsuDecoder_GetTrack(MsuDecoder *d, MsuPlayer *mp, int track, bool *hit) {
+  MsuCachedTrack *victim = NULL;
+  for (int i = 0; i < kMsuTrackCacheSize; i++) {
+    MsuCachedTrack *t = &d->cache[i];
+    if (t->data && t->track == track) {
+      t->last_used = ++d->cache_clock;
+      *hit = true;
+      return t;
+    }
+    if (t != d->cur && (!victim || !t->data || (victim->data && t->last_used < victim->last_used)))
+      victim = t;
+  }
+  *hit = false;
+  char fname[256];
+  size_t size;
+  MsuPlayer_GetFileName(mp, track, fname, sizeof(fname));
+  const uint8 *data = MapWholeFile(fname, &size);
+  if (!data)
+    return NULL;
+  UnmapWholeFile(victim->data, victim->size);
+  if (victim->opus)
+    opus_decoder_destroy(victim->opus);
+  memset(victim, 0, sizeof(*victim));
+  victim->track = track;
+  victim->data = data;
+  victim->size = size;
+  victim->last_used = ++d->cache_clock;
+  return victim;
+}
+
+static bool MsuDecoder_Start(MsuDecoder *d, MsuPlayer *mp, const MsuCommand *cmd) {
+  MsuDecoder_Close(d);
+  if (cmd->track == 0)
+    return false;
+  uint64 before = SDL_GetPerformanceCounter();
+  bool hit;
+  MsuCachedTrack *t = MsuDecoder_GetTrack(d, mp, cmd->track, &hit);
+  if (t == NULL || t->size < 8)
+    return false;
+  d->cur = t;
+  d->data = t->data;
+  d->size = t->size;
+  d->pos = 8;
+  uint32 file_tag = *(uint32 *)(d->data + 0);
+  if (file_tag != cmd->resume_info.tag)
+    return false;
+  d->repeat_position = *(uint32 *)(d->data + 4);
+  d->resuming = cmd->resuming;
+  d->resume_info = cmd->resume_info;
+  d->cur_file_offs = d->resume_info.offset;
+  d->samples_until_repeat = d->resume_info.samples_until_repeat;
+  d->range_cur = d->resume_info.range_cur;
+  d->range_repeat = d->resume_info.range_repeat;
+  d->preskip = 0;
+  d->is_opuz = (file_tag == (('Z' << 24) | ('U' << 16) | ('P' << 8) | 'O'));
+  if (d->is_opuz) {
+    if (!t->opus && !(t->opus = opus_decoder_create(48000, 2, NULL)))
+      return false;
+    opus_decoder_ctl(t->opus, OPUS_RESET_STATE);
+    if (d->resuming)
+      d->pos = d->cur_file_offs;
+  } else {
+    d->total_samples_in_file = (uint32)((d->size - 8) / 4);
+    d->samples_until_repeat = d->total_samples_in_file - d->cur_file_offs;
+    d->pos = (size_t)d->cur_file_offs * 4 + 8;
+  }
+  uint64 ticks = SDL_GetPerformanceCounter() - before;
+  if (hit)
+    d->stats.hits++, d->stats.hit_ticks += ticks;
+  else
+    d->stats.misses++, d->stats.miss_ticks += ticks;
+
+  // Leaving for a dungeon or house likely means going back to the hint
+  // track later, so map it ahead of time.
+  if (cmd->hint_track != 0 && cmd->hint_track != cmd->track) {
+    if (MsuDecoder_GetTrack(d, mp, cmd->hint_track, &hit) && !hit)
+      d->stats.preloads++;
+  }
+  return true;
+}
+
+// Decodes the next packet, including resolving loop points and range
+// commands. Returns the number of frames at |*pcm|, or a marker kind.
+static int MsuDecoder_Decode(MsuDecoder *d, int16 **pcm, uint8 *kind) {
+  int r;
+  if (d->is_opuz) {
+    if (d->samples_until_repeat == 0) {
+      if (d->range_cur == 0) FINISHED_PLAYING: {
+        *kind = kMsuMarker_Finished;
+        return 0;
+      }
+      opus_decoder_ctl(d->cur->opus, OPUS_RESET_STATE);
+      d->pos = d->range_cur;
+      uint8 *file_data = (uint8 *)d->buffer;
+      if (!MsuDecoder_Read(d, file_data, 10)) READ_ERROR: {
+        *kind = kMsuMarker_Error;
+        return 0;
+      }
+      uint32 file_offs = *(uint32 *)&file_data[0];
+      assert((file_offs & 0xF0000000) == 0);
+      uint32 samples_until_repeat = *(uint32 *)&file_data[4];
+      uint16 preskip = *(uint32 *)&file_data[8];
+      d->samples_until_repeat = samples_until_repeat;
+      d->preskip = preskip & 0x3fff;
+      if (preskip & 0x4000)
+        d->range_repeat = d->range_cur;
+      d->range_cur = (preskip & 0x8000) ? d->range_repeat : d->range_cur + 10;
+      d->cur_file_offs = file_offs;
+      d->resume_info.range_repeat = d->range_repeat;
+      d->resume_info.range_cur = d->range_cur;
+      d->pos = file_offs;
+    }
+    assert(d->samples_until_repeat != 0);
+    for (;;) {
+      uint8 *file_data = (uint8 *)d->buffer;
+      *(uint64 *)file_data = 0;
+      if (!MsuDecoder_Read(d, file_data, 2))
+        goto READ_ERROR;
+      int size = *(uint16 *)file_data & 0x7fff;
+      if (size > 1275)
+        goto READ_ERROR;
+      int n = (*(uint16 *)file_data >> 15);
+      if (!MsuDecoder_Read(d, &file_data[2], size))
+        goto READ_ERROR;
+      // Verify if the snapshot matches the file on disk.
+      uint64 initial_file_data = *(uint64 *)file_data;
+      if (d->resuming) {
+        d->resuming = false;
+        if (d->resume_info.initial_packet_bytes != initial_file_data)
+          goto READ_ERROR;
+      }
+      d->resume_info.initial_packet_bytes = initial_file_data;
+      d->resume_info.samples_until_repeat = d->samples_until_repeat + d->preskip;
+      d->resume_info.offset = d->cur_file_offs;
+      d->cur_file_offs += 2 + size;
+      file_data[1] = 0xfc;
+      r = opus_decode(d->cur->opus, &file_data[2 - n], size + n, d->buffer, 960, 0);
+      if (r <= 0)
+        goto READ_ERROR;
+      if (r > d->preskip)
+        break;
+      d->preskip -= r;
+    }
   } else {
-    goto READ_ERROR;
+    if (d->samples_until_repeat == 0) {
+      if (d->resume_info.actual_track < sizeof(kMsuTracksWithRepeat) && !kMsuTracksWithRepeat[d->resume_info.actual_track])
+        goto FINISHED_PLAYING;
+      d->samples_until_repeat = d->total_samples_in_file - d->repeat_position;
+      if (d->samples_until_repeat == 0)
+        goto READ_ERROR; // impossible to make progress
+      d->cur_file_offs = d->repeat_position;
+      d->pos = (size_t)d->cur_file_offs * 4 + 8;
+    }
+    r = UintMin(960, d->samples_until_repeat);
+    if (!MsuDecoder_Read(d, d->buffer, r * 4))
+      goto READ_ERROR;
+    d->resume_info.offset = d->cur_file_offs;
+    d->cur_file_offs += r;
+  }
+  uint32 n = UintMin(r - d->preskip, d->samples_until_repeat);
+  d->samples_until_repeat -= n;
+  *pcm = d->buffer + d->preskip * 2;
+  d->preskip = 0;
+  *kind = kMsuMarker_Packet;
+  return n;
+}
+
+static void MsuPlayer_QueueMarker(MsuPlayer *mp, uint8 kind, const MsuPlayerResumeInfo *resume_info) {
+  uint32 i = SDL_AtomicGet(&mp->marker_write);
+  MsuMarker *m = &mp->markers[i % kMsuRingMarkers];
+  m->pos = SDL_AtomicGet(&mp->write_pos);
+  m->kind = kind;
+  m->resume_info = *resume_info;
+  SDL_AtomicSet(&mp->marker_write, i + 1);
+}
+
+static void MsuPlayer_QueuePcm(MsuPlayer *mp, const int16 *pcm, uint32 n) {
+  uint32 pos = SDL_AtomicGet(&mp->write_pos);
+  while (n) {
+    uint32 i = pos & (kMsuRingFrames - 1), nr = UintMin(n, kMsuRingFrames - i);
+    memcpy(mp->ring + i * 2, pcm, nr * sizeof(int16) * 2);
+    pcm += nr * 2, pos += nr, n -= nr;
+  }
+  SDL_AtomicSet(&mp->write_pos, pos);
+}
+
+static int MsuWorkerThread(void *arg) {
+  MsuPlayer *mp = arg;
+  MsuDecoder *d = &g_msu_decoder;
+  bool active = false;
+  SDL_LockMutex(mp->mutex);
+  while (!mp->quit) {
+    if (mp->has_command) {
+      MsuCommand cmd = mp->command;
+      mp->has_command = false;
+      SDL_UnlockMutex(mp->mutex);
+      active = MsuDecoder_Start(d, mp, &cmd);
+      // Everything queued from here on belongs to the new track.
+      mp->ring_start = SDL_AtomicGet(&mp->write_pos);
+      mp->marker_start = SDL_AtomicGet(&mp->marker_write);
+      SDL_AtomicSet(&mp->ring_generation, cmd.generation);
+      if (!active && cmd.track != 0) {
+        fprintf(stderr, "Unable to read MSU track %d\n", cmd.track);
+        MsuPlayer_QueueMarker(mp, kMsuMarker_Error, &cmd.resume_info);
+        MsuDecoder_Close(d);
+      }
+      SDL_LockMutex(mp->mutex);
+      continue;
+    }
+    uint32 buffered = SDL_AtomicGet(&mp->write_pos) - SDL_AtomicGet(&mp->read_pos);
+    uint32 markers = SDL_AtomicGet(&mp->marker_write) - SDL_AtomicGet(&mp->marker_read);
+    if (active && buffered < kMsuReadAheadFrames && markers < kMsuRingMarkers) {
+      SDL_UnlockMutex(mp->mutex);
+      int16 *pcm;
+      uint8 kind;
+      int n = MsuDecoder_Decode(d, &pcm, &kind);
+      MsuPlayer_QueueMarker(mp, kind, &d->resume_info);
+      if (kind == kMsuMarker_Packet) {
+        MsuPlayer_QueuePcm(mp, pcm, n);
+      } else {
+        active = false;
+        MsuDecoder_Close(d);
+      }
+      SDL_LockMutex(mp->mutex);
+      continue;
+    }
+    // Nothing to do right now, find out which tracks exist in the meantime.
+    if (d->next_scan_track < kMsuMaxTracks) {
+      int track = d->next_scan_track++;
+      if (track != 0 && mp->headers[track].status == kMsuTrack_Unknown) {
+        MsuTrackHeader h;
+        SDL_UnlockMutex(mp->mutex);
+        MsuPlayer_ReadTrackHeader(mp, track, &h);
+        SDL_LockMutex(mp->mutex);
+        mp->headers[track] = h;
+      }
+      continue;
+    }
+    SDL_CondWaitTimeout(mp->cond, mp->mutex, 5);
   }
+  SDL_UnlockMutex(mp->mutex);
+  MsuDecoder_Close(d);
+  return 0;
 }
 
 static void MixToBufferWithVolume(int16 *dst, const int16 *src, size_t n, float volume) {
@@ -275,108 +668,72 @@ static void MixToBuffer(MsuPlayer *mp, int16 *dst, const int16 *src, uint32 n) {
     }
     float vol = mp->volume;
     mp->volume = new_vol;
+    // Without a destination only the volume moves.
+    if (dst == NULL)
+      return;
     MixToBufferWithVolumeRamp(dst, src, curn, vol, step, new_vol);
     dst += curn * 2, src += curn * 2, n -= curn;
   }
-  MixToBufferWithVolume(dst, src, n, mp->volume);
+  if (dst != NULL)
+    MixToBufferWithVolume(dst, src, n, mp->volume);
 }
 
-void MsuPlayer_Mix(MsuPlayer *mp, int16 *audio_buffer, int audio_samples) {
-  int r;
+static void MsuPlayer_WaitForWorker(MsuPlayer *mp) {
+  SDL_CondSignal(mp->cond);
+  SDL_Delay(1);
+}
 
-  do {
-    if (mp->buffer_size - mp->buffer_pos == 0) {
-      if (mp->opus != NULL) {
-        if (mp->samples_until_repeat == 0) {
-          if (mp->range_cur == 0) FINISHED_PLAYING: {
-            mp->state = kMsuState_FinishedPlaying;
-            MsuPlayer_CloseFile(mp);
-            return;
-          }
-          opus_decoder_ctl(mp->opus, OPUS_RESET_STATE);
-          fseek(mp->f, mp->range_cur, SEEK_SET);
-          uint8 *file_data = (uint8 *)mp->buffer;
-          if (fread(file_data, 1, 10, mp->f) != 10) READ_ERROR: {
-            fprintf(stderr, "MSU read/decode error!\n");
-            zelda_apu_write(APUI00, mp->resume_info.orig_track);
-            MsuPlayer_CloseFile(mp);
-            return;
-          }
-          uint32 file_offs = *(uint32 *)&file_data[0];
-          assert((file_offs & 0xF0000000) == 0);
-          uint32 samples_until_repeat = *(uint32 *)&file_data[4];
-          uint16 preskip = *(uint32 *)&file_data[8];
-          mp->samples_until_repeat = samples_until_repeat;
-          mp->preskip = preskip & 0x3fff;
-          if (preskip & 0x4000)
-            mp->range_repeat = mp->range_cur;
-          mp->range_cur = (preskip & 0x8000) ? mp->range_repeat : mp->range_cur + 10;
-          mp->cur_file_offs = file_offs;
-          mp->resume_info.range_repeat = mp->range_repeat;
-          mp->resume_info.range_cur = mp->range_cur;
-          fseek(mp->f, file_offs, SEEK_SET);
-        }
-        assert(mp->samples_until_repeat != 0);
-        for (;;) {
-          uint8 *file_data = (uint8 *)mp->buffer;
-          *(uint64 *)file_data = 0;
-          if (fread(file_data, 1, 2, mp->f) != 2)
-            goto READ_ERROR;
-          int size = *(uint16 *)file_data & 0x7fff;
-          if (size > 1275)
-            goto READ_ERROR;
-          int n = (*(uint16 *)file_data >> 15);
-          if (fread(&file_data[2], 1, size, mp->f) != size)
-            goto READ_ERROR;
-          // Verify if the snapshot matches the file on disk.
-          uint64 initial_file_data = *(uint64 *)file_data;
-          if (mp->state == kMsuState_Resuming) {
+void MsuPlayer_Mix(MsuPlayer *mp, int16 *audio_buffer, int audio_samples) {
+  // Wait for the worker to pick up the current track.
+  if (!mp->synced) {
+    while ((uint32)SDL_AtomicGet(&mp->ring_generation) != mp->generation) {
+      if (!mp->synchronous)
+        return;
+      MsuPlayer_WaitForWorker(mp);
+    }
+    SDL_AtomicSet(&mp->read_pos, mp->ring_start);
+    SDL_AtomicSet(&mp->marker_read, mp->marker_start);
+    mp->synced = true;
+  }
+  uint32 read_pos = SDL_AtomicGet(&mp->read_pos);
+  uint32 marker_read = SDL_AtomicGet(&mp->marker_read);
+
+  while (audio_samples != 0) {
+    // Markers are queued before their pcm, so this sees all markers up to
+    // the end of the available pcm.
+    uint32 write_pos = SDL_AtomicGet(&mp->write_pos);
+    uint32 avail = write_pos - read_pos;
+    if (marker_read != (uint32)SDL_AtomicGet(&mp->marker_write)) {
+      MsuMarker *m = &mp->markers[marker_read % kMsuRingMarkers];
+      if (m->pos == read_pos) {
+        marker_read++;
+        if (m->kind == kMsuMarker_Packet) {
+          if (mp->state == kMsuState_Resuming)
             mp->state = kMsuState_Playing;
-            if (mp->resume_info.initial_packet_bytes != initial_file_data)
-              goto READ_ERROR;
-          }
-          mp->resume_info.initial_packet_bytes = initial_file_data;
-          mp->resume_info.samples_until_repeat = mp->samples_until_repeat + mp->preskip;
-          mp->resume_info.offset = mp->cur_file_offs;
-          mp->cur_file_offs += 2 + size;
-          file_data[1] = 0xfc;
-          r = opus_decode(mp->opus, &file_data[2 - n], size + n, mp->buffer, 960, 0);
-          if (r <= 0)
-            goto READ_ERROR;
-          if (r > mp->preskip)
-            break;
-          mp->preskip -= r;
+          memcpy(&mp->resume_info, &m->resume_info, sizeof(mp->resume_info));
+          continue;
         }
-      } else {
-        if (mp->samples_until_repeat == 0) {
-          if (mp->resume_info.actual_track < sizeof(kMsuTracksWithRepeat) && !kMsuTracksWithRepeat[mp->resume_info.actual_track])
-            goto FINISHED_PLAYING;
-          mp->samples_until_repeat = mp->total_samples_in_file - mp->repeat_position;
-          if (mp->samples_until_repeat == 0)
-            goto READ_ERROR; // impossible to make progress
-          mp->cur_file_offs = mp->repeat_position;
-          fseek(mp->f, mp->cur_file_offs * 4 + 8, SEEK_SET);
+        if (m->kind == kMsuMarker_Error) {
+          fprintf(stderr, "MSU read/decode error!\n");
+          zelda_apu_write(APUI00, mp->resume_info.orig_track);
+        } else {
+          mp->state = kMsuState_FinishedPlaying;
         }
-        r = UintMin(960, mp->samples_until_repeat);
-        if (fread(mp->buffer, 4, r, mp->f) != r)
-          goto READ_ERROR;
-        mp->resume_info.offset = mp->cur_file_offs;
-        mp->cur_file_offs += r;
+        MsuPlayer_CloseFile(mp);
+        return;
       }
-      uint32 n = UintMin(r - mp->preskip, mp->samples_until_repeat);
-      mp->samples_until_repeat -= n;
-      mp->buffer_pos = mp->preskip;
-      mp->buffer_size = mp->buffer_pos + n;
-      mp->preskip = 0;
+      avail = UintMin(avail, m->pos - read_pos);
     }
-#if 0
-    if (mp->samples_to_play > 44100 * 5) {
-      mp->buffer_pos = mp->buffer_size;
+    // Underrun, the worker isn't keeping up.
+    if (avail == 0) {
+      if (!mp->synchronous)
+        break;
+      MsuPlayer_WaitForWorker(mp);
+      continue;
     }
-#endif
-    int nr = IntMin(audio_samples, mp->buffer_size - mp->buffer_pos);
-    int16 *buf = mp->buffer + mp->buffer_pos * 2;
-    mp->buffer_pos += nr;
+    uint32 i = read_pos & (kMsuRingFrames - 1);
+    int16 *buf = mp->ring + i * 2;
+    int nr = IntMin(audio_samples, UintMin(avail, kMsuRingFrames - i));
 
 #if 0
     static int t;
@@ -384,6 +741,17 @@ void MsuPlayer_Mix(MsuPlayer *mp, int16 *audio_buffer, int audio_samples) {
       buf[i * 2 + 0] = buf[i * 2 + 1] = 5000 * sinf(2 * 3.1415 * t++ / 440);
     }
 #endif
+    // The MSU is 44100 (pcm) or 48000 (opuz), convert if the device differs.
+    Resampler *rs = &mp->resampler;
+    if (rs->in_rate != rs->out_rate) {
+      int16 tmp[128 * 2];
+      uint32 want = UintMin(audio_samples, 128);
+      read_pos += Resampler_Push(rs, buf, UintMin(Resampler_InputWanted(rs, want), nr));
+      buf = tmp;
+      nr = Resampler_Pull(rs, tmp, want);
+    } else {
+      read_pos += nr;
+    }
     MixToBuffer(mp, audio_buffer, buf, nr);
 
 #if 0
@@ -392,8 +760,12 @@ void MsuPlayer_Mix(MsuPlayer *mp, int16 *audio_buffer, int audio_samples) {
     fwrite(audio_buffer, 4, nr, f);
     fflush(f);
 #endif
-    audio_samples -= nr, audio_buffer += nr * 2;
-  } while (audio_samples != 0);
+    audio_samples -= nr;
+    if (audio_buffer)
+      audio_buffer += nr * 2;
+  }
+  SDL_AtomicSet(&mp->read_pos, read_pos);
+  SDL_AtomicSet(&mp->marker_read, marker_read);
 }
 
 // Maintain a queue cause the snes and audio callback are not in sync.
@@ -401,7 +773,7 @@ struct ApuWriteEnt {
   uint8 ports[4];
 };
 static struct ApuWriteEnt g_apu_write_ents[16], g_apu_write;
-static uint8 g_apu_write_ent_pos, g_apu_write_count, g_apu_total_write;
+static uint8 g_apu_write_ent_pos, g_apu_write_count;
 void zelda_apu_write(uint32_t adr, uint8_t val) {
   g_apu_write.ports[adr & 0x3] = val;
 }
@@ -411,7 +783,6 @@ void ZeldaPushApuState() {
   g_apu_write_ents[g_apu_write_ent_pos++ & 0xf] = g_apu_write;
   if (g_apu_write_count < 16)
     g_apu_write_count++;
-  g_apu_total_write++;
   ZeldaApuUnlock();
 }
 
@@ -420,19 +791,8 @@ static void ZeldaPopApuState() {
     memcpy(g_zenv.player->input_ports, &g_apu_write_ents[(g_apu_write_ent_pos - g_apu_write_count--) & 0xf], 4);
 }
 
-void ZeldaDiscardUnusedAudioFrames() {
-  if (g_apu_write_count != 0 && memcmp(g_zenv.player->input_ports, &g_apu_write_ents[(g_apu_write_ent_pos - g_apu_write_count) & 0xf], 4) == 0) {
-    if (g_apu_total_write >= 16) {
-      g_apu_total_write = 14;
-      g_apu_write_count--;
-    }
-  } else {
-    g_apu_total_write = 0;
-  }
-}
-
 static void ZeldaResetApuQueue() {
-  g_apu_write_ent_pos = g_apu_total_write = g_apu_write_count = 0;
+  g_apu_write_ent_pos = g_apu_write_count = 0;
 }
 
 uint8_t zelda_read_apui00() {
@@ -447,16 +807,47 @@ uint8_t zelda_apu_read(uint32_t adr) {
   return g_zenv.player->port_to_snes[adr & 0x3];
 }
 
+// Like dsp_getSamples, but through the configured resampler instead of
+// nearest neighbour.
+static void ResampleDspSamples(Dsp *dsp, int16 *audio_buffer, int samples, int channels) {
+  if (channels == 2)
+    Resampler_ProcessBlock(&g_dsp_resampler, dsp->sampleBuffer, 534, audio_buffer, samples);
+  else
+    Resampler_ProcessBlockMono(&g_dsp_resampler, dsp->sampleBuffer, 534, audio_buffer, samples);
+  dsp->sampleOffset = 0;
+}
+
+void ZeldaSetAudioOutputFreq(int freq) {
+  g_audio_out_freq = freq;
+  Resampler_Init(&g_dsp_resampler, g_config.resampler_quality, 32000, freq);
+}
+
+void ZeldaSetMsuSynchronous(bool synchronous) {
+  g_msu_player.synchronous = synchronous;
+}
+
 void ZeldaRenderAudio(int16 *audio_buffer, int samples, int channels) {
   ZeldaApuLock();
   ZeldaPopApuState();
   SpcPlayer_GenerateSamples(g_zenv.player);
-  dsp_getSamples(g_zenv.player->dsp, audio_buffer, samples, channels);
-  if (g_msu_player.f && channels == 2)
+  if (g_dsp_resampler.quality != kResampler_Nearest)
+    ResampleDspSamples(g_zenv.player->dsp, audio_buffer, samples, channels);
+  else
+    dsp_getSamples(g_zenv.player->dsp, audio_buffer, samples, channels);
+  if (g_msu_player.state >= kMsuState_Resuming && channels == 2)
     MsuPlayer_Mix(&g_msu_player, audio_buffer, samples);
   ZeldaApuUnlock();
 }
 
+void ZeldaSkipAudio(int samples, int channels) {
+  ZeldaApuLock();
+  ZeldaPopApuState();
+  SpcPlayer_RunWithoutSamples(g_zenv.player);
+  if (g_msu_player.state >= kMsuState_Resuming && channels == 2)
+    MsuPlayer_Mix(&g_msu_player, NULL, samples);
+  ZeldaApuUnlock();
+}
+
 bool ZeldaIsMusicPlaying() {
   if (g_msu_player.state != kMsuState_Idle) {
     return g_msu_player.state != kMsuState_FinishedPlaying;
@@ -511,20 +902,26 @@ void ZeldaSaveMusicStateToRam_Locked() {
   // be in the queue. 0x410 is a free memory location in the SPC ram, so store it there.
   SpcPlayer *spc_player = g_zenv.player;
   memcpy(&spc_player->ram[0x410], g_apu_write.ports, 4);
+  dsp_invalidateBrrCache(spc_player->dsp, 0x410, 4);
 
   msu_volume = g_msu_player.volume * 255;
   memcpy(msu_resume_info, &g_msu_player.resume_info, sizeof(g_msu_player.resume_info));
 }
 
 void ZeldaEnableMsu(uint8 enable) {
+  if (!enable)
+    ZeldaShutdownMsu();
   g_msu_player.volume = 1.0f;
   g_msu_player.enabled = enable;
-  if (enable & kMsuEnabled_Opuz) {
-    if (g_config.audio_freq != 48000)
-      fprintf(stderr, "Warning: MSU Opuz requires: AudioFreq = 48000\n");
-  } else if (enable) {
-    if (g_config.audio_freq != 44100)
-      fprintf(stderr, "Warning: MSU requires: AudioFreq = 44100\n");
+  if (enable && !g_msu_player.thread) {
+    MsuPlayer *mp = &g_msu_player;
+    mp->mutex = SDL_CreateMutex();
+    mp->cond = SDL_CreateCond();
+    if (!mp->mutex || !mp->cond)
+      Die("No mutex");
+    mp->thread = SDL_CreateThread(&MsuWorkerThread, "msu", mp);
+    if (!mp->thread)
+      Die("Unable to create MSU thread");
   }
 
   float volscale = g_config.msuvolume * (1.0f / 255 / 100);
@@ -535,6 +932,48 @@ void ZeldaEnableMsu(uint8 enable) {
   }
 }
 
+void ZeldaShutdownMsu() {
+  MsuPlayer *mp = &g_msu_player;
+  if (!mp->thread)
+    return;
+  SDL_LockMutex(mp->mutex);
+  mp->quit = true;
+  SDL_CondSignal(mp->cond);
+  SDL_UnlockMutex(mp->mutex);
+  SDL_WaitThread(mp->thread, NULL);
+  SDL_DestroyCond(mp->cond);
+  SDL_DestroyMutex(mp->mutex);
+  mp->thread = NULL, mp->mutex = NULL, mp->cond = NULL;
+  mp->quit = mp->has_command = false;
+  // Nothing is left to mix, and the headers depend on the MSU flags.
+  ZeldaApuLock();
+  MsuPlayer_CloseFile(mp);
+  mp->state = kMsuState_Idle;
+  Resampler_Destroy(&mp->resampler);
+  ZeldaApuUnlock();
+  memset(mp->headers, 0, sizeof(mp->headers));
+
+  MsuDecoder *d = &g_msu_decoder;
+  for (int i = 0; i < kMsuTrackCacheSize; i++) {
+    MsuCachedTrack *t = &d->cache[i];
+    UnmapWholeFile(t->data, t->size);
+    if (t->opus)
+      opus_decoder_destroy(t->opus);
+    memset(t, 0, sizeof(*t));
+  }
+  d->next_scan_track = 0;
+}
+
+void ZeldaPrintMsuStats() {
+  MsuStats *st = &g_msu_decoder.stats;
+  if (st->hits + st->misses == 0)
+    return;
+  double f = 1000.0 / SDL_GetPerformanceFrequency();
+  printf("MSU: %u track starts from cache (avg %.3f ms), %u mapped (avg %.3f ms), %u mapped ahead\n",
+         st->hits, st->hits ? st->hit_ticks * f / st->hits : 0.0,
+         st->misses, st->misses ? st->miss_ticks * f / st->misses : 0.0, st->preloads);
+}
+
 void LoadSongBank(const uint8 *p) {  // 808888
   ZeldaApuLock();
   SpcPlayer_Upload(g_zenv.player, p);
@@ -10,9 +10,19 @@ void ZeldaPlayMsuAudioTrack(uint8 track);
 bool ZeldaIsMusicPlaying();
 
 void ZeldaEnableMsu(uint8 enable);
+// Stops and joins the MSU worker and closes the tracks it has open. Called
+// when the MSU gets disabled, at exit and before forking, since a child only
+// gets the calling thread.
+void ZeldaShutdownMsu();
+void ZeldaSetAudioOutputFreq(int freq);
+// Makes the mixer block on the MSU worker so output doesn't depend on timing.
+void ZeldaSetMsuSynchronous(bool synchronous);
+void ZeldaPrintMsuStats();
 
 void ZeldaRenderAudio(int16 *audio_buffer, int samples, int channels);
-void ZeldaDiscardUnusedAudioFrames();
+// Moves the music along by a frame like ZeldaRenderAudio without producing
+// any samples, for frames nobody listens to.
+void ZeldaSkipAudio(int samples, int channels);
 void ZeldaRestoreMusicAfterLoad_Locked(bool is_reset);
 void ZeldaSaveMusicStateToRam_Locked();
 void ZeldaPushApuState();
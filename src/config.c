@@ -387,6 +387,11 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
     } else if (StringEqualsNoCase(key, "AudioSamples")) {
       g_config.audio_samples = (uint16)strtol(value, (char**)NULL, 10);
       return true;
+    } else if (StringEqualsNoCase(key, "DynamicRateControl")) {
+      return ParseBool(value, &g_config.dynamic_rate_control);
+    } else if (StringEqualsNoCase(key, "ResamplerQuality")) {
+      g_config.resampler_quality = (uint8)strtol(value, (char**)NULL, 10);
+      return true;
     } else if (StringEqualsNoCase(key, "EnableMSU")) {
         if (StringEqualsNoCase(value, "opuz"))
         g_config.enable_msu = kMsuEnabled_Opuz;
@@ -442,6 +447,8 @@ static bool HandleIniConfig(int section, const char *key, char *value) {
       return ParseBool(value, &g_config.display_perf_title);
     } else if (StringEqualsNoCase(key, "DisableFrameDelay")) {
       return ParseBool(value, &g_config.disable_frame_delay);
+    } else if (StringEqualsNoCase(key, "EmulationThread")) {
+      return ParseBool(value, &g_config.emulation_thread);
     } else if (StringEqualsNoCase(key, "Language")) {
       g_config.language = value;
       return true;
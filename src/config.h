@@ -58,6 +58,8 @@ typedef struct Config {
   uint16 audio_freq;
   uint8 audio_channels;
   uint16 audio_samples;
+  bool dynamic_rate_control;
+  uint8 resampler_quality;
   bool autosave;
   uint8 extended_aspect_ratio;
   bool extend_y;
@@ -66,6 +68,7 @@ typedef struct Config {
   uint8 enable_msu;
   bool resume_msu;
   bool disable_frame_delay;
+  bool emulation_thread;
   uint8 msuvolume;
   uint32 features0;
 
@@ -7,6 +7,10 @@
 #include "sprite.h"
 #include "assets.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Allow this to be overwritten
 uint16 kGlovesColor[2] = {0x52f6, 0x376};
 
@@ -959,18 +963,127 @@ void Do3To4Low(uint16 *vram_ptr, const uint8 *decomp_addr) {  // 80e63c
   }
 }
 
+// Room, area and mirror warp transitions decompress the same few dozen
+// sheets over and over. The decompressed sheets, and the 4bpp expansion of
+// the ones that go to vram through Do3To4High/Do3To4Low, are kept here so
+// that a transition is only memcpys. WRAM still receives the same bytes.
+enum {
+  kGfxSheetCache_MaxSize = 0x1000,
+};
+
+typedef struct GfxSheetCacheEntry {
+  uint16 size;
+  bool uncacheable;
+  uint8 *data;
+  uint16 *expanded[2];  // Do3To4Low, Do3To4High
+} GfxSheetCacheEntry;
+
+static GfxSheetCacheEntry g_gfx_sheet_cache[2][256];
+static bool g_gfx_sheet_cache_disabled;
+GfxSheetCacheStats g_gfx_sheet_cache_stats;
+
+void GfxSheetCache_SetEnabled(bool enabled) {
+  g_gfx_sheet_cache_disabled = !enabled;
+}
+
+void GfxSheetCache_Clear() {
+  for (int kind = 0; kind < 2; kind++) {
+    for (int i = 0; i < 256; i++) {
+      GfxSheetCacheEntry *e = &g_gfx_sheet_cache[kind][i];
+      free(e->data);
+      free(e->expanded[0]);
+      free(e->expanded[1]);
+      memset(e, 0, sizeof(*e));
+    }
+  }
+}
+
+static GfxSheetCacheEntry *GfxSheetCache_Fill(int kind, int gfx, const uint8 *src) {
+  GfxSheetCacheEntry *e = &g_gfx_sheet_cache[kind][gfx];
+  // Back references are relative to the start of the output, so a sheet
+  // that reads bytes it didn't write depends on what was in WRAM before.
+  // Decode it over two different backgrounds and only keep it if they agree.
+  uint8 *a = malloc(0x10000), *b = malloc(0x10000);
+  if (!a || !b)
+    Die("Out of memory");
+  memset(a, 0x00, 0x10000);
+  memset(b, 0xff, 0x10000);
+  int len = Decompress(a, src);
+  if (len == Decompress(b, src) && len > 0 && len <= kGfxSheetCache_MaxSize && memcmp(a, b, len) == 0) {
+    e->data = realloc(a, len);
+    e->size = len;
+    a = NULL;
+  } else {
+    e->uncacheable = true;
+  }
+  free(a);
+  free(b);
+  return e;
+}
+
+int GfxSheetCache_Decompress(uint8 *dst, int kind, int gfx, const uint8 *src) {
+  GfxSheetCacheEntry *e = &g_gfx_sheet_cache[kind][gfx & 0xff];
+  if (g_gfx_sheet_cache_disabled || gfx != (gfx & 0xff) || e->uncacheable)
+    return Decompress(dst, src);
+  if (!e->data) {
+    g_gfx_sheet_cache_stats.misses++;
+    if (!GfxSheetCache_Fill(kind, gfx, src)->data)
+      return Decompress(dst, src);
+  } else {
+    g_gfx_sheet_cache_stats.hits++;
+  }
+  memcpy(dst, e->data, e->size);
+  return e->size;
+}
+
+bool GfxSheetCache_Expand(uint16 *vram_ptr, int kind, int gfx, bool high, const uint8 *decomp_addr, int len) {
+  GfxSheetCacheEntry *e = &g_gfx_sheet_cache[kind][gfx & 0xff];
+  // Sprite sheets below 12 are clamped by Decomp_spr, uncompressed ones
+  // aren't in the cache at all.
+  if (g_gfx_sheet_cache_disabled || gfx != (gfx & 0xff) || len != 0x600 || !e->data || e->size != 0x600 ||
+      memcmp(decomp_addr, e->data, 0x600) != 0)
+    return false;
+  uint16 *x = e->expanded[high];
+  if (!x) {
+    x = e->expanded[high] = malloc(0x400 * sizeof(uint16));
+    if (!x)
+      Die("Out of memory");
+    if (high)
+      Do3To4High(x, e->data);
+    else
+      Do3To4Low(x, e->data);
+  }
+  memcpy(vram_ptr, x, 0x400 * sizeof(uint16));
+  if (high) {
+    // Do3To4High leaves the masks of the last tile in dung_line_ptrs_row0.
+    uint16 *t = (uint16 *)&dung_line_ptrs_row0;
+    const uint8 *last = e->data + 63 * 24;
+    for (int i = 7; i >= 0; i--, last += 2) {
+      uint16 d = WORD(last[0]);
+      t[i] = (d | (d >> 8)) & 0xff;
+    }
+  }
+  return true;
+}
+
 void LoadSpriteGraphics(uint16 *vram_ptr, int gfx_pack, uint8 *decomp_addr) {  // 80e583
-  Decomp_spr(decomp_addr, gfx_pack);
-  if (gfx_pack == 0x52 || gfx_pack == 0x53 || gfx_pack == 0x5a || gfx_pack == 0x5b ||
-      gfx_pack == 0x5c || gfx_pack == 0x5e || gfx_pack == 0x5f)
+  int len = Decomp_spr(decomp_addr, gfx_pack);
+  bool high = (gfx_pack == 0x52 || gfx_pack == 0x53 || gfx_pack == 0x5a || gfx_pack == 0x5b ||
+               gfx_pack == 0x5c || gfx_pack == 0x5e || gfx_pack == 0x5f);
+  if (GfxSheetCache_Expand(vram_ptr, kGfxSheet_Spr, gfx_pack, high, decomp_addr, len))
+    return;
+  if (high)
     Do3To4High(vram_ptr, decomp_addr);
   else
     Do3To4Low(vram_ptr, decomp_addr);
 }
 
 void LoadBackgroundGraphics(uint16 *vram_ptr, int gfx_pack, int slot, uint8 *decomp_addr) {  // 80e609
-  Decomp_bg(decomp_addr, gfx_pack);
-  if ((main_tile_theme_index >= 0x20) ? (slot == 7 || slot == 2 || slot == 3 || slot == 4) : (slot >= 4))
+  int len = Decomp_bg(decomp_addr, gfx_pack);
+  bool high = (main_tile_theme_index >= 0x20) ? (slot == 7 || slot == 2 || slot == 3 || slot == 4) : (slot >= 4);
+  if (GfxSheetCache_Expand(vram_ptr, kGfxSheet_Bg, gfx_pack, high, decomp_addr, len))
+    return;
+  if (high)
     Do3To4High(vram_ptr, decomp_addr);
   else
     Do3To4Low(vram_ptr, decomp_addr);
@@ -995,20 +1108,23 @@ int Decomp_spr(uint8 *dst, int gfx) {  // 80e772
   const uint8 *sprite_data = GetCompSpritePtr(gfx);
   // If the size is not 0x600 then it's compressed
   if (gfx >= 103 || blk.size != 0x600)
-    return Decompress(dst, blk.ptr);
+    return GfxSheetCache_Decompress(dst, kGfxSheet_Spr, gfx, blk.ptr);
   memcpy(dst, blk.ptr, 0x600);
   return 0x600;
 }
 
 int Decomp_bg(uint8 *dst, int gfx) {  // 80e78f
-  return Decompress(dst, kBgGfx(gfx).ptr);
+  return GfxSheetCache_Decompress(dst, kGfxSheet_Bg, gfx, kBgGfx(gfx).ptr);
 }
 
-int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
+// Same output as the original byte at a time decoder, which make test
+// compares it with. Every command is a bulk copy or fill, writing exactly
+// |len| bytes since the output goes to WRAM.
+int LzDecompress(uint8 *dst, const uint8 *src, bool big_endian_offs) {
   uint8 *dst_org = dst;
-  int len;
   for (;;) {
     uint8 cmd = *src++;
+    size_t len;
     if (cmd == 0xff)
       return dst - dst_org;
     if ((cmd & 0xe0) != 0xe0) {
@@ -1019,41 +1135,56 @@ int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
       len += ((cmd & 3) << 8) + 1;
       cmd = (cmd << 3) & 0xe0;
     }
-    //printf("%d: %d,%d\n", (int)(dst - dst_org), cmd, len);
     if (cmd == 0) {
-      do {
-        *dst++ = *src++;
-      } while (--len);
+      memcpy(dst, src, len);
+      src += len;
     } else if (cmd & 0x80) {
-      uint32 offs = *src++;
-      offs |= *src++ << 8;
-      do {
-        *dst++ = dst_org[offs++];
-      } while (--len);
+      const uint8 *from = dst_org + (big_endian_offs ? src[0] << 8 | src[1] : src[0] | src[1] << 8);
+      src += 2;
+      if (from >= dst || from + len <= dst) {
+        // Reading ahead of the write position never sees the new bytes.
+        memmove(dst, from, len);
+      } else if (dst - from == 1) {
+        memset(dst, *from, len);
+      } else {
+        // Overlapping, repeats the last |dst - from| bytes.
+        size_t dist = dst - from, i = 0;
+        for (; i + dist <= len; i += dist)
+          memcpy(dst + i, from + i, dist);
+        memcpy(dst + i, from + i, len - i);
+      }
+      dst += len;
+      continue;
     } else if (!(cmd & 0x40)) {
-      uint8 v = *src++;
-      do {
-        *dst++ = v;
-      } while (--len);
-    } else if (!(cmd & 0x20)) {
-      uint8 lo = *src++;
-      uint8 hi = *src++;
-      do {
-        *dst++ = lo;
-        if (--len == 0)
-          break;
-        *dst++ = hi;
-      } while (--len);
+      memset(dst, *src++, len);
     } else {
-      // copy bytes with the byte incrementing by 1 in between
-      uint8 v = *src++;
-      do {
-        *dst++ = v;
-      } while (v++, --len);
+      uint8 v0 = src[0], v1 = src[1];
+      bool incr = (cmd & 0x20) != 0;
+      src += incr ? 1 : 2;
+      size_t i = 0;
+#if defined(__SSE2__)
+      __m128i v = incr ? _mm_add_epi8(_mm_set1_epi8(v0), _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))
+                       : _mm_set1_epi16(v0 | v1 << 8);
+      __m128i step = _mm_set1_epi8(incr ? 16 : 0);
+      for (; i + 16 <= len; i += 16, v = _mm_add_epi8(v, step))
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+#endif
+      if (incr) {
+        for (; i < len; i++)
+          dst[i] = (uint8)(v0 + i);
+      } else {
+        for (; i < len; i++)
+          dst[i] = (i & 1) ? v1 : v0;
+      }
     }
+    dst += len;
   }
 }
 
+int Decompress(uint8 *dst, const uint8 *src) {  // 80e79e
+  return LzDecompress(dst, src, false);
+}
+
 void ResetHUDPalettes4and5() {  // 80eb29
   for (int i = 0; i < 8; i++)
     main_palette_buffer[16 + i] = 0;
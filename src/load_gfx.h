@@ -60,6 +60,20 @@ void LoadCommonSprites();
 int Decomp_spr(uint8 *dst, int gfx);
 int Decomp_bg(uint8 *dst, int gfx);
 int Decompress(uint8 *dst, const uint8 *src);
+int LzDecompress(uint8 *dst, const uint8 *src, bool big_endian_offs);
+
+enum {
+  kGfxSheet_Spr = 0,
+  kGfxSheet_Bg = 1,
+};
+typedef struct GfxSheetCacheStats {
+  uint32 hits, misses;
+} GfxSheetCacheStats;
+extern GfxSheetCacheStats g_gfx_sheet_cache_stats;
+int GfxSheetCache_Decompress(uint8 *dst, int kind, int gfx, const uint8 *src);
+bool GfxSheetCache_Expand(uint16 *vram_ptr, int kind, int gfx, bool high, const uint8 *decomp_addr, int len);
+void GfxSheetCache_SetEnabled(bool enabled);
+void GfxSheetCache_Clear();
 void ResetHUDPalettes4and5();
 void PaletteFilterHistory();
 void PaletteFilter_WishPonds();
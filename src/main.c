@@ -3,10 +3,13 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 #include <SDL.h>
 #ifdef _WIN32
 #include "platform/win32/volume_control.h"
 #include <direct.h>
+#include <process.h>
+#define getpid _getpid
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -23,6 +26,7 @@
 
 #include "config.h"
 #include "assets.h"
+#include "asset_loader.h"
 #include "load_gfx.h"
 #include "util.h"
 #include "audio.h"
@@ -47,7 +51,7 @@ static void HandleGamepadInput(int player, int button, bool pressed);
 static void HandleGamepadAxisInput(int player, int gamepad_id, int axis, int value);
 static void OpenOneGamepad(int i);
 static void HandleVolumeAdjustment(int volume_adjustment);
-static void LoadAssets();
+static void StartupTrace_FramePresented();
 static void SwitchDirectory();
 static int GetPlayerForController(int controller_id, enum ControllerType type);
 static void ConfigureMultiplayerViewport();
@@ -61,6 +65,7 @@ enum {
 };
 
 static const char kWindowTitle[] = "The Legend of Zelda: A Link to the Past";
+static const char kAssetsFile[] = "zelda3_assets.dat";
 static uint32 g_win_flags = SDL_WINDOW_RESIZABLE;
 static SDL_Window *g_window;
 
@@ -158,15 +163,7 @@ static SDL_HitTestResult HitTestCallback(SDL_Window *win, const SDL_Point *pt, v
   return SDL_HITTEST_NORMAL;
 }
 
-static void DrawPpuFrameWithPerf() {
-  int render_scale = PpuGetCurrentRenderScale(g_zenv.ppu, g_ppu_render_flags);
-  ZeldaPreparePpuSideSpace(g_ppu_render_flags);
-  uint8 *pixel_buffer = 0;
-  int pitch = 0;
-
-  g_renderer_funcs.BeginDraw(g_snes_width * render_scale,
-                             g_snes_height * render_scale,
-                             &pixel_buffer, &pitch);
+static void RenderPpuFrameWithPerf(uint8 *pixel_buffer, int pitch, int render_scale) {
   if (g_display_perf || g_config.display_perf_title) {
     static float history[64], average;
     static int history_pos;
@@ -183,36 +180,424 @@ static void DrawPpuFrameWithPerf() {
   }
   if (g_display_perf)
     RenderNumber(pixel_buffer + pitch * render_scale, pitch, g_curr_fps, render_scale == 4);
+}
+
+// Histogram of the time between presented frames, in 1ms buckets.
+typedef struct FrameTimeHistogram {
+  uint64 last;
+  uint32 count;
+  double sum, sum_sq;
+  uint32 buckets[33];
+} FrameTimeHistogram;
+
+static FrameTimeHistogram g_frame_time_histogram;
+
+static void FrameTimeHistogram_Add(FrameTimeHistogram *h) {
+  uint64 now = SDL_GetPerformanceCounter();
+  if (h->last != 0) {
+    double ms = (double)(now - h->last) * 1000.0 / SDL_GetPerformanceFrequency();
+    h->count++;
+    h->sum += ms;
+    h->sum_sq += ms * ms;
+    h->buckets[IntMin((int)ms, 32)]++;
+  }
+  h->last = now;
+}
+
+static void FrameTimeHistogram_Print(FrameTimeHistogram *h, const char *mode) {
+  if (h->count == 0)
+    return;
+  double mean = h->sum / h->count;
+  double var = h->sum_sq / h->count - mean * mean;
+  uint32 peak = 1;
+  for (int i = 0; i < 33; i++)
+    peak = UintMax(peak, h->buckets[i]);
+  printf("Frame interval (%s): %u frames, mean %.2f ms, stddev %.2f ms\n",
+         mode, h->count, mean, var > 0 ? sqrt(var) : 0.0);
+  for (int i = 0; i < 33; i++) {
+    if (h->buckets[i] == 0)
+      continue;
+    printf("  %s%2d ms %7u |", i == 32 ? ">=" : "  ", i, h->buckets[i]);
+    for (int j = 0, n = (h->buckets[i] * 50 + peak - 1) / peak; j < n; j++)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+static void DrawPpuFrameWithPerf() {
+  int render_scale = PpuGetCurrentRenderScale(g_zenv.ppu, g_ppu_render_flags);
+  ZeldaPreparePpuSideSpace(g_ppu_render_flags);
+  uint8 *pixel_buffer = 0;
+  int pitch = 0;
+
+  g_renderer_funcs.BeginDraw(g_snes_width * render_scale,
+                             g_snes_height * render_scale,
+                             &pixel_buffer, &pitch);
+  RenderPpuFrameWithPerf(pixel_buffer, pitch, render_scale);
   g_renderer_funcs.EndDraw();
+  StartupTrace_FramePresented();
+  FrameTimeHistogram_Add(&g_frame_time_histogram);
+}
+
+static void UpdateWindowTitle() {
+  if (g_config.display_perf_title) {
+    char title[60];
+    snprintf(title, sizeof(title), "%s | FPS: %d", kWindowTitle, g_curr_fps);
+    SDL_SetWindowTitle(g_window, title);
+  }
+}
+
+// if vsync isn't working, delay manually
+static void ThrottleFrame(uint32 *lastTick, uint32 frameCtr) {
+  uint32 curTick = SDL_GetTicks();
+
+  if (!g_config.disable_frame_delay) {
+    static const uint8 delays[3] = { 17, 17, 16 }; // 60 fps
+    *lastTick += delays[frameCtr % 3];
+
+    if (*lastTick > curTick) {
+      uint32 delta = *lastTick - curTick;
+      if (delta > 500) {
+        *lastTick = curTick - 500;
+        delta = 500;
+      }
+//        printf("Sleeping %d\n", delta);
+      SDL_Delay(delta);
+    } else if (curTick - *lastTick > 500) {
+      *lastTick = curTick;
+    }
+  }
+}
+
+static void GetFrameInputs(int *inputs1, int *inputs2) {
+  // Clear gamepad inputs when joypad directional inputs to avoid wonkiness
+  *inputs1 = g_input_state[0];
+  *inputs2 = g_input_state[1];
+  if (g_input_state[0] & 0xf0)
+    g_gamepad_buttons[0] = 0;
+  if (g_input_state[1] & 0xf0)
+    g_gamepad_buttons[1] = 0;
+  *inputs1 |= g_gamepad_buttons[0];
+  *inputs2 |= g_gamepad_buttons[1];
 }
 
 static SDL_mutex *g_audio_mutex;
-static uint8 *g_audiobuffer, *g_audiobuffer_cur, *g_audiobuffer_end;
+static uint8 *g_audiobuffer;
 static int g_frames_per_block;
+static double g_audio_block_size, g_audio_block_frac;
 static uint8 g_audio_channels;
+static int g_audio_freq, g_audio_device_samples;
+
+// Audio is generated on the emulation side, one APU frame per game frame,
+// into a lock-free single producer, single consumer ring. The audio callback
+// only copies out of it, so it never waits for the game or the SPC player.
+// Positions are free running byte counters, the size is a power of two.
+typedef struct AudioRing {
+  uint8 *data;
+  uint32 size_mask;
+  uint32 start_threshold;  // bytes buffered before playback (re)starts
+  bool started;            // owned by the consumer
+  SDL_atomic_t write_pos, read_pos;
+  // Latency probe. The producer stamps the start of a write while none is
+  // pending, and the consumer times it once it reads that byte.
+  SDL_atomic_t probe_pending;
+  uint32 probe_pos;
+  uint64 probe_ticks;
+} AudioRing;
+
+static AudioRing g_audio_ring;
+
+typedef struct AudioStats {
+  uint32 callbacks, underruns;  // written by the consumer
+  uint32 overruns;              // written by the producer
+  uint64 fill_sum;
+  uint32 fill_min, fill_max;
+  // Measured time from a write into the ring until it's read, in ticks of
+  // SDL_GetPerformanceFrequency. Written by the consumer.
+  uint32 latency_probes;
+  uint64 latency_sum, latency_max;
+  // Dynamic rate control, written by the producer
+  uint32 drc_frames, drc_adjusted;
+  double drc_ratio_sum, drc_ratio_min, drc_ratio_max;
+} AudioStats;
+
+static AudioStats g_audio_stats = { .fill_min = 0xffffffff, .drc_ratio_min = 2.0 };
+
+// Dynamic rate control slightly stretches or shrinks each APU frame to keep
+// the ring at its start threshold, like RetroArch does. The game and the sound
+// card clocks drift apart, and this hides it without dropping or repeating
+// frames. The ratio changes by at most this much, which isn't audible.
+static const double kAudioRateControlDelta = 0.005;
+
+static uint32 AudioRing_Avail(AudioRing *r) {
+  return (uint32)SDL_AtomicGet(&r->write_pos) - (uint32)SDL_AtomicGet(&r->read_pos);
+}
+
+static bool AudioRing_Write(AudioRing *r, const uint8 *src, uint32 n) {
+  uint32 wp = SDL_AtomicGet(&r->write_pos);
+  if (r->size_mask + 1 - (wp - (uint32)SDL_AtomicGet(&r->read_pos)) < n)
+    return false;
+  uint32 o = wp & r->size_mask, m = UintMin(n, r->size_mask + 1 - o);
+  memcpy(r->data + o, src, m);
+  memcpy(r->data, src + m, n - m);
+  SDL_AtomicSet(&r->write_pos, wp + n);
+  return true;
+}
+
+static uint32 AudioRing_Read(AudioRing *r, uint8 *dst, uint32 n) {
+  uint32 rp = SDL_AtomicGet(&r->read_pos);
+  n = UintMin(n, (uint32)SDL_AtomicGet(&r->write_pos) - rp);
+  uint32 o = rp & r->size_mask, m = UintMin(n, r->size_mask + 1 - o);
+  memcpy(dst, r->data + o, m);
+  memcpy(dst + m, r->data, n - m);
+  SDL_AtomicSet(&r->read_pos, rp + n);
+  return n;
+}
 
 static void SDLCALL AudioCallback(void *userdata, Uint8 *stream, int len) {
-  if (SDL_LockMutex(g_audio_mutex)) Die("Mutex lock failed!");
+  AudioRing *r = &g_audio_ring;
+  uint32 avail = AudioRing_Avail(r);
+  uint32 frame_size = g_audio_channels * sizeof(int16);
+  uint32 fill = avail / frame_size;
+  g_audio_stats.callbacks++;
+  g_audio_stats.fill_sum += fill;
+  g_audio_stats.fill_min = UintMin(g_audio_stats.fill_min, fill);
+  g_audio_stats.fill_max = UintMax(g_audio_stats.fill_max, fill);
+
+  if (!r->started) {
+    if (avail < r->start_threshold) {
+      SDL_memset(stream, 0, len);
+      return;
+    }
+    r->started = true;
+  }
+
   while (len != 0) {
-    if (g_audiobuffer_end - g_audiobuffer_cur == 0) {
-      ZeldaRenderAudio((int16*)g_audiobuffer, g_frames_per_block, g_audio_channels);
-      g_audiobuffer_cur = g_audiobuffer;
-      g_audiobuffer_end = g_audiobuffer + g_frames_per_block * g_audio_channels * sizeof(int16);
+    uint8 tmp[2048];
+    uint8 *dst = (g_sdl_audio_mixer_volume == SDL_MIX_MAXVOLUME) ? stream : tmp;
+    int n = AudioRing_Read(r, dst, IntMin(len, dst == tmp ? sizeof(tmp) : len));
+    if (n == 0) {
+      // Underrun, play silence until enough audio has been buffered again.
+      SDL_memset(stream, 0, len);
+      g_audio_stats.underruns++;
+      r->started = false;
+      break;
     }
-    int n = IntMin(len, g_audiobuffer_end - g_audiobuffer_cur);
-    if (g_sdl_audio_mixer_volume == SDL_MIX_MAXVOLUME) {
-      memcpy(stream, g_audiobuffer_cur, n);
-    } else {
+    if (dst == tmp) {
       SDL_memset(stream, 0, n);
-      SDL_MixAudioFormat(stream, g_audiobuffer_cur, AUDIO_S16, n, g_sdl_audio_mixer_volume);
+      SDL_MixAudioFormat(stream, tmp, AUDIO_S16, n, g_sdl_audio_mixer_volume);
     }
-    g_audiobuffer_cur += n;
     stream += n;
     len -= n;
   }
 
-  ZeldaDiscardUnusedAudioFrames();
-  SDL_UnlockMutex(g_audio_mutex);
+  if (SDL_AtomicGet(&r->probe_pending) && (int32)(SDL_AtomicGet(&r->read_pos) - r->probe_pos) > 0) {
+    uint64 t = SDL_GetPerformanceCounter() - r->probe_ticks;
+    g_audio_stats.latency_probes++;
+    g_audio_stats.latency_sum += t;
+    g_audio_stats.latency_max = t > g_audio_stats.latency_max ? t : g_audio_stats.latency_max;
+    SDL_AtomicSet(&r->probe_pending, 0);
+  }
+}
+
+static void AudioRing_Init(AudioRing *r, uint32 frame_size) {
+  // Playback starts with one device buffer plus one APU frame queued.
+  uint32 start = (g_audio_device_samples + g_frames_per_block) * frame_size;
+  uint32 size = 1;
+  while (size < start * 2)
+    size <<= 1;
+  r->data = malloc(size);
+  if (!r->data)
+    Die("Out of memory");
+  r->size_mask = size - 1;
+  r->start_threshold = start;
+  r->started = false;
+  SDL_AtomicSet(&r->write_pos, 0);
+  SDL_AtomicSet(&r->read_pos, 0);
+  SDL_AtomicSet(&r->probe_pending, 0);
+}
+
+// Called after each game frame, outside of the lock.
+static void ProduceAudioFrame() {
+  if (g_audiobuffer == NULL)
+    return;
+  uint32 frame_size = g_audio_channels * sizeof(int16);
+  double want = g_audio_block_size;
+  if (g_config.dynamic_rate_control) {
+    AudioStats *st = &g_audio_stats;
+    double target = (double)g_audio_ring.start_threshold / frame_size;
+    double fill = (double)(AudioRing_Avail(&g_audio_ring) / frame_size);
+    double direction = (target - fill) / target;
+    direction = direction < -1.0 ? -1.0 : direction > 1.0 ? 1.0 : direction;
+    double ratio = 1.0 + kAudioRateControlDelta * direction;
+    want *= ratio;
+    st->drc_frames++;
+    st->drc_adjusted += (ratio != 1.0);
+    st->drc_ratio_sum += ratio;
+    st->drc_ratio_min = ratio < st->drc_ratio_min ? ratio : st->drc_ratio_min;
+    st->drc_ratio_max = ratio > st->drc_ratio_max ? ratio : st->drc_ratio_max;
+  }
+  // Carry the fraction over so the average rate is exact.
+  g_audio_block_frac += want;
+  uint32 n = (uint32)g_audio_block_frac;
+  g_audio_block_frac -= n;
+  ZeldaRenderAudio((int16 *)g_audiobuffer, n, g_audio_channels);
+  AudioRing *r = &g_audio_ring;
+  uint32 wp = SDL_AtomicGet(&r->write_pos);
+  if (!AudioRing_Write(r, g_audiobuffer, n * frame_size)) {
+    g_audio_stats.overruns++;
+  } else if (n != 0 && !SDL_AtomicGet(&r->probe_pending)) {
+    r->probe_pos = wp;
+    r->probe_ticks = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&r->probe_pending, 1);
+  }
+}
+
+static void PrintAudioStats() {
+  AudioStats *st = &g_audio_stats;
+  if (st->callbacks == 0)
+    return;
+  double avg_fill = (double)st->fill_sum / st->callbacks;
+  // On average a sample waits for the ring, then for the device buffer.
+  printf("Audio: %u callbacks, %u underruns, %u dropped frames, ring fill avg %.0f min %u max %u samples\n",
+         st->callbacks, st->underruns, st->overruns, avg_fill, st->fill_min, st->fill_max);
+  if (st->drc_frames != 0)
+    printf("Audio: rate control adjusted %u of %u frames, ratio avg %.5f min %.5f max %.5f\n",
+           st->drc_adjusted, st->drc_frames, st->drc_ratio_sum / st->drc_frames, st->drc_ratio_min, st->drc_ratio_max);
+  // The ring latency is timed. What the device buffer and the driver add
+  // after the callback can't be seen from here, so that part is estimated
+  // from the buffer size.
+  double freq_ms = 1000.0 / SDL_GetPerformanceFrequency();
+  if (st->latency_probes != 0)
+    printf("Audio: measured ring latency avg %.1f ms max %.1f ms over %u writes\n",
+           st->latency_sum * freq_ms / st->latency_probes, st->latency_max * freq_ms, st->latency_probes);
+  printf("Audio: estimated latency %.1f ms from the ring fill and the device buffer (AudioSamples = %d, %d Hz)\n",
+         (avg_fill + g_audio_device_samples) * 1000.0 / g_audio_freq, g_audio_device_samples, g_audio_freq);
+}
+
+// When EmulationThread is enabled, the game and the PPU run on their own
+// thread and hand finished frames to the main thread through a triple buffer.
+// The main thread keeps SDL events, ImGui and the GL context.
+// |g_frame_queue_middle| holds the index of the slot that is neither being
+// written nor displayed, plus kFrameQueue_Fresh if it holds an unseen frame.
+// Turning on kFrameQueue_Fresh also posts |g_frame_queued_event|, which
+// wakes the main thread from SDL_WaitEvent.
+// The inputs go the other way: the main thread owns the input state and
+// publishes both joypads in |g_emu_inputs| after handling its events.
+enum {
+  kFrameQueue_Fresh = 4,
+};
+
+typedef struct QueuedFrame {
+  uint8 *pixels;
+  int width, height;
+} QueuedFrame;
+
+static QueuedFrame g_frame_queue[3];
+static int g_frame_queue_back = 0, g_frame_queue_front = 2;
+static SDL_atomic_t g_frame_queue_middle;
+static SDL_atomic_t g_emu_thread_running;
+static SDL_atomic_t g_emu_inputs;
+static uint32 g_frame_queued_event;
+
+static void PublishEmulationInputs() {
+  int inputs1, inputs2;
+  GetFrameInputs(&inputs1, &inputs2);
+  SDL_AtomicSet(&g_emu_inputs, inputs1 | inputs2 << 16);
+}
+
+static int SDLCALL EmulationThread(void *userdata) {
+  uint32 lastTick = SDL_GetTicks();
+  uint32 frameCtr = 0;
+
+  while (SDL_AtomicGet(&g_emu_thread_running)) {
+    if (g_paused) {
+      SDL_Delay(16);
+      lastTick = SDL_GetTicks();
+      continue;
+    }
+    // Inputs are read right after the throttle sleep, as late as possible.
+    int inputs = SDL_AtomicGet(&g_emu_inputs);
+
+    // The PPU is rendered under the lock too, since the main thread may
+    // load a snapshot at any time.
+    SDL_LockMutex(g_audio_mutex);
+    bool is_replay = ZeldaRunFrame(inputs & 0xffff, inputs >> 16);
+    frameCtr++;
+    bool skip = (g_turbo ^ (is_replay & g_replay_turbo)) && (frameCtr & (g_turbo ? 0xf : 0x7f)) != 0;
+    if (!skip) {
+      QueuedFrame *f = &g_frame_queue[g_frame_queue_back];
+      int render_scale = PpuGetCurrentRenderScale(g_zenv.ppu, g_ppu_render_flags);
+      ZeldaPreparePpuSideSpace(g_ppu_render_flags);
+      f->width = g_snes_width * render_scale;
+      f->height = g_snes_height * render_scale;
+      RenderPpuFrameWithPerf(f->pixels, f->width * 4, render_scale);
+    }
+    SDL_UnlockMutex(g_audio_mutex);
+    ProduceAudioFrame();
+
+    if (skip)
+      continue;
+    int prev = SDL_AtomicSet(&g_frame_queue_middle, g_frame_queue_back | kFrameQueue_Fresh);
+    g_frame_queue_back = prev & 3;
+    // The main thread presents whatever is fresh once it wakes, so one wakeup
+    // per frame it hasn't seen yet is enough.
+    if (!(prev & kFrameQueue_Fresh)) {
+      SDL_Event event = { .type = g_frame_queued_event };
+      SDL_PushEvent(&event);
+    }
+    ThrottleFrame(&lastTick, frameCtr);
+  }
+  return 0;
+}
+
+static SDL_Thread *StartEmulationThread() {
+  // Room for the largest frame, 4x4 mode7 included.
+  size_t size = (size_t)g_snes_width * 4 * g_snes_height * 4 * 4;
+  for (int i = 0; i < 3; i++) {
+    g_frame_queue[i].pixels = calloc(1, size);
+    if (!g_frame_queue[i].pixels)
+      Die("Out of memory");
+  }
+  g_frame_queue_back = 0;
+  g_frame_queue_front = 2;
+  SDL_AtomicSet(&g_frame_queue_middle, 1);
+  SDL_AtomicSet(&g_emu_thread_running, 1);
+  g_frame_queued_event = SDL_RegisterEvents(1);
+  if (g_frame_queued_event == (uint32)-1)
+    Die("Unable to register the frame event");
+  PublishEmulationInputs();
+  SDL_Thread *thread = SDL_CreateThread(&EmulationThread, "emulation", NULL);
+  if (!thread)
+    Die("Unable to create emulation thread");
+  return thread;
+}
+
+static void StopEmulationThread(SDL_Thread *thread) {
+  SDL_AtomicSet(&g_emu_thread_running, 0);
+  SDL_WaitThread(thread, NULL);
+  for (int i = 0; i < 3; i++) {
+    free(g_frame_queue[i].pixels);
+    g_frame_queue[i].pixels = NULL;
+  }
+}
+
+// Returns false if the emulation thread hasn't finished a new frame yet.
+static bool PresentQueuedFrame() {
+  if (!(SDL_AtomicGet(&g_frame_queue_middle) & kFrameQueue_Fresh))
+    return false;
+  g_frame_queue_front = SDL_AtomicSet(&g_frame_queue_middle, g_frame_queue_front) & 3;
+  QueuedFrame *f = &g_frame_queue[g_frame_queue_front];
+  uint8 *pixel_buffer = 0;
+  int pitch = 0;
+  g_renderer_funcs.BeginDraw(f->width, f->height, &pixel_buffer, &pitch);
+  for (int y = 0; y < f->height; y++)
+    memcpy(pixel_buffer + y * pitch, f->pixels + y * f->width * 4, f->width * 4);
+  g_renderer_funcs.EndDraw();
+  StartupTrace_FramePresented();
+  FrameTimeHistogram_Add(&g_frame_time_histogram);
+  UpdateWindowTitle();
+  return true;
 }
 
 // State for sdl renderer
@@ -291,10 +676,88 @@ static const struct RendererFuncs kSdlRendererFuncs  = {
 
 void OpenGLRenderer_Create(struct RendererFuncs *funcs, bool use_opengl_es);
 
+// Wall time of each startup phase up to the first presented frame, printed
+// with DisplayPerfInTitle along with where the assets came from and the
+// memory in use at that point. Phases of the init thread overlap the ones of
+// the main thread.
+enum { kStartupMaxPhases = 16 };
+typedef struct StartupPhase {
+  const char *name;
+  bool on_init_thread;
+  uint64 begin, end;
+} StartupPhase;
+static StartupPhase g_startup_phases[kStartupMaxPhases];
+static SDL_atomic_t g_startup_num_phases;
+static uint64 g_startup_ticks;
+static SDL_threadID g_startup_main_thread;
+static bool g_startup_frame_presented;
+
+static int StartupPhase_Begin(const char *name) {
+  int i = SDL_AtomicAdd(&g_startup_num_phases, 1);
+  assert(i < kStartupMaxPhases);
+  StartupPhase *p = &g_startup_phases[i];
+  p->name = name;
+  p->on_init_thread = SDL_ThreadID() != g_startup_main_thread;
+  p->begin = SDL_GetPerformanceCounter();
+  return i;
+}
+
+static void StartupPhase_End(int i) {
+  g_startup_phases[i].end = SDL_GetPerformanceCounter();
+}
+
+static void StartupTrace_FramePresented() {
+  if (g_startup_frame_presented)
+    return;
+  g_startup_frame_presented = true;
+  if (!g_config.display_perf_title)
+    return;
+  double to_ms = 1000.0 / SDL_GetPerformanceFrequency();
+  size_t rss = GetResidentMemory();
+  printf("Startup: first frame after %.1f ms, assets %s with %zu bytes private", (SDL_GetPerformanceCounter() - g_startup_ticks) * to_ms,
+         g_assets_source, GetPrivateAssetBytes());
+  if (rss)
+    printf(", RSS %.1f MB", rss / 1048576.0);
+  printf("\n");
+  int n = SDL_AtomicGet(&g_startup_num_phases);
+  for (int i = 0; i < n; i++) {
+    StartupPhase *p = &g_startup_phases[i];
+    printf("  %-14s %7.1f ms, %7.1f - %7.1f%s\n", p->name, (p->end - p->begin) * to_ms,
+           (p->begin - g_startup_ticks) * to_ms, (p->end - g_startup_ticks) * to_ms,
+           p->on_init_thread ? " (init thread)" : "");
+  }
+}
+
+// Settings that need the game state from ZeldaInitialize.
+static void ApplyGameConfig() {
+  g_zenv.ppu->extraLeftRight = UintMin(g_config.extended_aspect_ratio, kPpuExtraLeftRight);
+  ZeldaEnableMsu(g_config.enable_msu);
+  ZeldaSetLanguage(g_config.language);
+}
+
+// Loads the assets and sets up the game state. A normal start runs this on
+// its own thread while the main thread initializes SDL, the window, the
+// renderer and the audio device, which don't depend on it.
+static int InitThreadMain(void *arg) {
+  int phase = StartupPhase_Begin("assets");
+  LoadAssets(kAssetsFile);
+  StartupPhase_End(phase);
+  phase = StartupPhase_Begin("link graphics");
+  LoadLinkGraphics();
+  StartupPhase_End(phase);
+  phase = StartupPhase_Begin("game init");
+  ZeldaInitialize();
+  StartupPhase_End(phase);
+  return 0;
+}
+
 #undef main
 int main(int argc, char** argv) {
+  g_startup_ticks = SDL_GetPerformanceCounter();
+  g_startup_main_thread = SDL_ThreadID();
   argc--, argv++;
   const char *config_file = NULL;
+  int phase = StartupPhase_Begin("config");
   if (argc >= 2 && strcmp(argv[0], "--config") == 0) {
     config_file = argv[1];
     argc -= 2, argv += 2;
@@ -303,11 +766,12 @@ int main(int argc, char** argv) {
   }
   ParseConfigFile(config_file);
   ConfigureMultiplayerViewport();
-  LoadAssets();
-  LoadLinkGraphics();
+  StartupPhase_End(phase);
+
+  SDL_Thread *init_thread = SDL_CreateThread(&InitThreadMain, "init", NULL);
+  if (!init_thread)
+    Die("Unable to create init thread");
 
-  ZeldaInitialize();
-  g_zenv.ppu->extraLeftRight = UintMin(g_config.extended_aspect_ratio, kPpuExtraLeftRight);
   g_snes_width = (g_config.extended_aspect_ratio * 2 + 256);
   g_snes_height = (g_config.extend_y ? 240 : 224);
 
@@ -319,8 +783,6 @@ int main(int argc, char** argv) {
                        g_config.enhanced_mode7 * kPpuRenderFlags_4x4Mode7 |
                        g_config.extend_y * kPpuRenderFlags_Height240 |
                        g_config.no_sprite_limits * kPpuRenderFlags_NoSpriteLimits;
-  ZeldaEnableMsu(g_config.enable_msu);
-  ZeldaSetLanguage(g_config.language);
 
   if (g_config.fullscreen == 1)
     g_win_flags ^= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -343,10 +805,12 @@ int main(int argc, char** argv) {
     g_config.audio_samples = kDefaultSamples;
 
   // set up SDL
+  phase = StartupPhase_Begin("sdl init");
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
     printf("Failed to init SDL: %s\n", SDL_GetError());
     return 1;
   }
+  StartupPhase_End(phase);
 
   bool custom_size  = g_config.window_width != 0 && g_config.window_height != 0;
   int window_width  = custom_size ? g_config.window_width  : g_current_window_scale * g_snes_width;
@@ -363,6 +827,7 @@ int main(int argc, char** argv) {
     g_renderer_funcs = kSdlRendererFuncs;
   }
 
+  phase = StartupPhase_Begin("window");
   SDL_Window* window = SDL_CreateWindow(kWindowTitle, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, window_width, window_height, g_win_flags);
   if(window == NULL) {
     printf("Failed to create window: %s\n", SDL_GetError());
@@ -370,15 +835,21 @@ int main(int argc, char** argv) {
   }
   g_window = window;
  // SDL_SetWindowHitTest(window, HitTestCallback, NULL);
+  StartupPhase_End(phase);
 
+  // The GL context belongs to the main thread, so the shaders get compiled
+  // here, while the init thread is still busy.
+  phase = StartupPhase_Begin("renderer");
   if (!g_renderer_funcs.Initialize(window))
     return 1;
+  StartupPhase_End(phase);
 
   SDL_AudioDeviceID device = 0;
   SDL_AudioSpec want = { 0 }, have;
   g_audio_mutex = SDL_CreateMutex();
   if (!g_audio_mutex) Die("No mutex");
 
+  phase = StartupPhase_Begin("audio device");
   if (g_config.enable_audio) {
     want.freq = g_config.audio_freq;
     want.format = AUDIO_S16;
@@ -391,10 +862,31 @@ int main(int argc, char** argv) {
       return 1;
     }
     g_audio_channels = have.channels;
+    g_audio_freq = have.freq;
+    g_audio_device_samples = have.samples;
+    ZeldaSetAudioOutputFreq(have.freq);
     g_frames_per_block = (534 * have.freq) / 32000;
-    g_audiobuffer = malloc(g_frames_per_block * have.channels * sizeof(int16));
+    g_audio_block_size = 534.0 * have.freq / 32000;
+    // Room for the largest frame rate control can ask for.
+    int max_block = (int)(g_audio_block_size * (1.0 + kAudioRateControlDelta)) + 1;
+    g_audiobuffer = malloc(max_block * have.channels * sizeof(int16));
+    AudioRing_Init(&g_audio_ring, have.channels * sizeof(int16));
   }
+  StartupPhase_End(phase);
 
+  phase = StartupPhase_Begin("gamepads");
+  for (int i = 0; i < SDL_NumJoysticks(); i++)
+    OpenOneGamepad(i);
+  // Initialize gamepad config (controller mappings)
+  loadButtonConfig();
+  StartupPhase_End(phase);
+
+  phase = StartupPhase_Begin("wait for init");
+  SDL_WaitThread(init_thread, NULL);
+  ApplyGameConfig();
+  StartupPhase_End(phase);
+
+  phase = StartupPhase_Begin("rom and sram");
   if (argc >= 1 && !g_run_without_emu)
     LoadRom(argv[0]);
 
@@ -405,29 +897,28 @@ int main(int argc, char** argv) {
 #endif
 
   ZeldaReadSram();
-
-  for (int i = 0; i < SDL_NumJoysticks(); i++)
-    OpenOneGamepad(i);
+  StartupPhase_End(phase);
 
   bool running = true;
   SDL_Event event;
   uint32 lastTick = SDL_GetTicks();
-  uint32 curTick = 0;
   uint32 frameCtr = 0;
   bool audiopaused = true;
 
   if (g_config.autosave)
     HandleCommand(kKeys_Load + 0, true);
 
-  // Initialize gamepad config (controller mappings)
-  loadButtonConfig();
-
   bool is_gamecontroller[SDL_NumJoysticks()];
   for (int i = 0; i < SDL_NumJoysticks(); i++) {
     is_gamecontroller[i] = SDL_IsGameController(i);
   }
 
+  SDL_Thread *emu_thread = g_config.emulation_thread ? StartEmulationThread() : NULL;
+
   while(running) {
+    // With the emulation thread, sleep until there's an event or a new frame.
+    if (emu_thread && !g_paused)
+      SDL_WaitEvent(NULL);
     while(SDL_PollEvent(&event)) {
       ImGui_ProcessEvent(&event);
 
@@ -533,19 +1024,19 @@ int main(int argc, char** argv) {
       continue;
     }
 
-    // Clear gamepad inputs when joypad directional inputs to avoid wonkiness
-    int inputs1 = g_input_state[0];
-    int inputs2 = g_input_state[1];
-    if (g_input_state[0] & 0xf0)
-      g_gamepad_buttons[0] = 0;
-    if (g_input_state[1] & 0xf0)
-      g_gamepad_buttons[1] = 0;
-    inputs1 |= g_gamepad_buttons[0];
-    inputs2 |= g_gamepad_buttons[1];
+    if (emu_thread) {
+      PublishEmulationInputs();
+      PresentQueuedFrame();
+      continue;
+    }
+
+    int inputs1, inputs2;
+    GetFrameInputs(&inputs1, &inputs2);
 
     SDL_LockMutex(g_audio_mutex);
     bool is_replay = ZeldaRunFrame(inputs1, inputs2);
     SDL_UnlockMutex(g_audio_mutex);
+    ProduceAudioFrame();
 
     frameCtr++;
 
@@ -554,33 +1045,17 @@ int main(int argc, char** argv) {
     }
 
     DrawPpuFrameWithPerf();
-
-    if (g_config.display_perf_title) {
-      char title[60];
-      snprintf(title, sizeof(title), "%s | FPS: %d", kWindowTitle, g_curr_fps);
-      SDL_SetWindowTitle(g_window, title);
-    }
-
-    // if vsync isn't working, delay manually
-    curTick = SDL_GetTicks();
-
-    if (!g_config.disable_frame_delay) {
-      static const uint8 delays[3] = { 17, 17, 16 }; // 60 fps
-      lastTick += delays[frameCtr % 3];
-
-      if (lastTick > curTick) {
-        uint32 delta = lastTick - curTick;
-        if (delta > 500) {
-          lastTick = curTick - 500;
-          delta = 500;
-        }
-//        printf("Sleeping %d\n", delta);
-        SDL_Delay(delta);
-      } else if (curTick - lastTick > 500) {
-        lastTick = curTick;
-      }
-    }
+    UpdateWindowTitle();
+    ThrottleFrame(&lastTick, frameCtr);
+  }
+  if (emu_thread)
+    StopEmulationThread(emu_thread);
+  if (g_config.display_perf_title) {
+    FrameTimeHistogram_Print(&g_frame_time_histogram, emu_thread ? "emulation thread" : "single thread");
+    PrintAudioStats();
+    ZeldaPrintMsuStats();
   }
+
   if (g_config.autosave)
     HandleCommand(kKeys_Save + 0, true);
 
@@ -590,8 +1065,10 @@ int main(int argc, char** argv) {
     SDL_CloseAudioDevice(device);
   }
 
+  ZeldaShutdownMsu();
   SDL_DestroyMutex(g_audio_mutex);
   free(g_audiobuffer);
+  free(g_audio_ring.data);
 
   g_renderer_funcs.Destroy();
 
@@ -878,9 +1355,9 @@ static bool ParseLinkGraphics(uint8 *file, size_t length) {
     return false;
   if (kPalette_ArmorAndGloves_SIZE != 150 || kLinkGraphics_SIZE != 0x7000)
     Die("ParseLinkGraphics: Invalid asset sizes");
-  memcpy(kLinkGraphics, file + pixel_offs, 0x7000);
+  memcpy(MakeAssetWritable(kLinkGraphics), file + pixel_offs, 0x7000);
   if (palette_length >= 120)
-    memcpy(kPalette_ArmorAndGloves, file + palette_offs, 120);
+    memcpy(MakeAssetWritable(kPalette_ArmorAndGloves), file + palette_offs, 120);
   if (palette_length >= 124)
     memcpy(kGlovesColor, file + palette_offs + 120, 4);
   return true;
@@ -897,53 +1374,6 @@ static void LoadLinkGraphics() {
   }
 }
 
-
-const uint8 *g_asset_ptrs[kNumberOfAssets];
-uint32 g_asset_sizes[kNumberOfAssets];
-
-static void LoadAssets() {
-  size_t length = 0;
-  uint8 *data = ReadWholeFile("zelda3_assets.dat", &length);
-  if (!data) {
-    size_t bps_length, bps_src_length;
-    uint8 *bps, *bps_src;
-    bps = ReadWholeFile("zelda3_assets.bps", &bps_length);
-    if (!bps)
-      Die("Failed to read zelda3_assets.dat. Please see the README for information about how you get this file.");
-    bps_src = ReadWholeFile("zelda3.sfc", &bps_src_length);
-    if (!bps_src)
-      Die("Missing file: zelda3.sfc");
-    data = ApplyBps(bps_src, bps_src_length, bps, bps_length, &length);
-    if (!data)
-      Die("Unable to apply zelda3_assets.bps. Please make sure you got the right version of 'zelda3.sfc'");
-  }
-
-  static const char kAssetsSig[] = { kAssets_Sig };
-
-  if (length < 16 + 32 + 32 + 8 + kNumberOfAssets * 4 ||
-      memcmp(data, kAssetsSig, 48) != 0 ||
-      *(uint32*)(data + 80) != kNumberOfAssets)
-    Die("Invalid assets file");
-
-  uint32 offset = 88 + kNumberOfAssets * 4 + *(uint32 *)(data + 84);
-
-  for (size_t i = 0; i < kNumberOfAssets; i++) {
-    uint32 size = *(uint32 *)(data + 88 + i * 4);
-    offset = (offset + 3) & ~3;
-    if ((uint64)offset + size > length)
-      Die("Assets file corruption");
-    g_asset_sizes[i] = size;
-    g_asset_ptrs[i] = data + offset;
-    offset += size;
-  }
-
-  if (g_config.features0 & kFeatures0_DimFlashes) { // patch dungeon floor palettes
-    kPalette_DungBgMain[0x484] = 0x70;
-    kPalette_DungBgMain[0x485] = 0x95;
-    kPalette_DungBgMain[0x486] = 0x57;
-  }
-}
-
 // Go some steps up and find zelda3.ini
 static void SwitchDirectory() {
   char buf[4096];
@@ -969,7 +1399,3 @@ static void SwitchDirectory() {
       pos--;
   }
 }
-
-MemBlk FindInAssetArray(int asset, int idx) {
-  return FindIndexInMemblk((MemBlk) { g_asset_ptrs[asset], g_asset_sizes[asset] }, idx);
-}
@@ -16,6 +16,7 @@
 #include "attract.h"
 #include "nmi.h"
 #include "assets.h"
+#include "util.h"
 
 static void WorldMap_AddSprite(int spr, uint8 big, uint8 flags, uint8 ch, uint16 x, uint16 y);
 static bool WorldMap_CalculateOamCoordinates(Point16U *pt);
@@ -2261,49 +2262,159 @@ uint32 Text_DecodeCmd(uint8 a, const uint8 *src) {
   }
 }
 
-// Perform initial parsing of the string, expanding words, processing some commands, etc.
-void Text_LoadCharacterBuffer() {  // 8ec4e2
+// The commands that depend on game state, run each time a message is loaded.
+// The others are left in the buffer for the renderer.
+static bool Text_IsLoadTimeCmd(uint32 cmd) {
+  switch (TEXTCMD_CMD(cmd)) {
+  case kTextCmd_Name: case kTextCmd_Window: case kTextCmd_Number:
+  case kTextCmd_Position: case kTextCmd_Color:
+    return true;
+  }
+  return false;
+}
+
+static uint8 *Text_RunLoadTimeCmd(uint32 cmd, uint8 *dst) {
+  switch (TEXTCMD_CMD(cmd)) {
+  case kTextCmd_Name: dst = Text_WritePlayerName(dst); break;
+  case kTextCmd_Window:  // RenderText_ExtendedCommand_SetWindowType
+    text_render_state = TEXTCMD_PARAM(cmd);
+    break;
+  case kTextCmd_Number: {  // Text_WritePreloadedNumber
+    uint8 t = TEXTCMD_PARAM(cmd);
+    uint8 v = dialogue_number[t >> 1];
+    *dst++ = 0x34 + ((t & 1) ? v >> 4 : v & 0xf);
+    break;
+  }
+  case kTextCmd_Position:
+    text_msgbox_topleft = kText_Positions[TEXTCMD_PARAM(cmd)];
+    break;
+  case kTextCmd_Color:
+    text_tilemap_cur = ((0x387F & 0xe300) | 0x180) | (TEXTCMD_PARAM(cmd) << 10) & 0x3c00;
+    break;
+  }
+  return dst;
+}
+
+// Every message of a language with the dictionary words expanded, built on
+// first use. The commands that Text_RunLoadTimeCmd handles are kept as tokens
+// between runs of plain bytes, so loading a message is a few copies.
+enum {
+  kDecodedText_Run = 0,  // uint16 length, then the bytes
+  kDecodedText_Cmd = 1,  // source byte and the byte after it
+  kDecodedTextLanguages = 8,
+};
+
+typedef struct DecodedDialogue {
+  const uint8 *blk;
+  uint8 flags;
+  int num_messages;
+  uint32 *offs;  // num_messages + 1 offsets into data
+  uint8 *data;
+  uint32 last_used;
+} DecodedDialogue;
+
+static DecodedDialogue g_decoded_dialogue[kDecodedTextLanguages];
+static uint32 g_decoded_dialogue_clock;
+
+static void DecodedDialogue_EndRun(ByteArray *out, size_t run_start) {
+  uint16 len = (uint16)(out->size - run_start - 3);
+  if (len == 0)
+    out->size = run_start;
+  else
+    memcpy(out->data + run_start + 1, &len, 2);
+}
+
+static void DecodedDialogue_Build(DecodedDialogue *dd) {
+  static const uint8 kZero[3] = { 0 };  // Run header, patched by DecodedDialogue_EndRun
   MemBlk dictionary = FindIndexInMemblk(g_zenv.dialogue_blk, 0);
   MemBlk dialogue = FindIndexInMemblk(g_zenv.dialogue_blk, 1);
-  MemBlk text_str = FindIndexInMemblk(dialogue, dialogue_message_index);
-  const uint8 *src = text_str.ptr, *src_end = src + text_str.size, *src_org = src;
-  uint8 *dst = messaging_text_buffer;
-  while (src < src_end) {
-    uint8 c = *src++;
-    if (c >= kTextDictBase) {
-      MemBlk blk = FindIndexInMemblk(dictionary, c - kTextDictBase);
-      memcpy(dst, blk.ptr, blk.size);
-      dst += blk.size;
-      continue;
+  int n = 0;
+  while (FindIndexInMemblk(dialogue, n).ptr)
+    n++;
+  ByteArray out = { 0 };
+  uint32 *offs = malloc(sizeof(uint32) * (n + 1));
+  if (!offs)
+    Die("Out of memory");
+  for (int i = 0; i < n; i++) {
+    offs[i] = (uint32)out.size;
+    MemBlk text_str = FindIndexInMemblk(dialogue, i);
+    const uint8 *src = text_str.ptr, *src_end = src + text_str.size;
+    size_t run_start = out.size;
+    ByteArray_AppendData(&out, kZero, sizeof(kZero));
+    while (src < src_end) {
+      uint8 c = *src++;
+      if (c >= kTextDictBase) {
+        MemBlk blk = FindIndexInMemblk(dictionary, c - kTextDictBase);
+        ByteArray_AppendData(&out, blk.ptr, blk.size);
+        continue;
+      }
+      // Decode the next byte or multibyte character (in case we support that in the future)
+      // This is dependent on the current language cause US / PAL encode commands differently
+      uint32 cmd = Text_DecodeCmd(c, src);
+      if (Text_IsLoadTimeCmd(cmd)) {
+        DecodedDialogue_EndRun(&out, run_start);
+        ByteArray_AppendByte(&out, kDecodedText_Cmd);
+        ByteArray_AppendByte(&out, c);
+        ByteArray_AppendByte(&out, TEXTCMD_MULTIBYTE(cmd) ? *src : 0);
+        run_start = out.size;
+        ByteArray_AppendData(&out, kZero, sizeof(kZero));
+      } else {
+        // This combination is handled when rendering instead of here
+        ByteArray_AppendByte(&out, c);
+        if (TEXTCMD_MULTIBYTE(cmd))
+          ByteArray_AppendByte(&out, *src);
+      }
+      src += TEXTCMD_MULTIBYTE(cmd);
     }
-    // Decode the next byte or multibyte character (in case we support that in the future)
-    // This is dependent on the current language cause US / PAL encode commands differently
-    uint32 cmd = Text_DecodeCmd(c, src);
-    switch (TEXTCMD_CMD(cmd)) {
-    case kTextCmd_Name: dst = Text_WritePlayerName(dst); break;
-    case kTextCmd_Window:  // RenderText_ExtendedCommand_SetWindowType
-      text_render_state = TEXTCMD_PARAM(cmd);
-      break;
-    case kTextCmd_Number: {  // Text_WritePreloadedNumber
-      uint8 t = TEXTCMD_PARAM(cmd);
-      uint8 v = dialogue_number[t >> 1];
-      *dst++ = 0x34 + ((t & 1) ? v >> 4 : v & 0xf);
-      break;
+    DecodedDialogue_EndRun(&out, run_start);
+  }
+  offs[n] = (uint32)out.size;
+  dd->blk = g_zenv.dialogue_blk.ptr;
+  dd->flags = g_zenv.dialogue_flags;
+  dd->num_messages = n;
+  dd->offs = offs;
+  dd->data = out.data;
+}
+
+// Evicts the least recently used language when all slots are taken.
+static DecodedDialogue *DecodedDialogue_Get() {
+  DecodedDialogue *dd = g_decoded_dialogue, *victim = dd;
+  for (int i = 0; i < kDecodedTextLanguages; i++, dd++) {
+    if (dd->blk == g_zenv.dialogue_blk.ptr && dd->flags == g_zenv.dialogue_flags) {
+      dd->last_used = ++g_decoded_dialogue_clock;
+      return dd;
     }
-    case kTextCmd_Position:
-      text_msgbox_topleft = kText_Positions[TEXTCMD_PARAM(cmd)];
-      break;
-    case kTextCmd_Color:
-      text_tilemap_cur = ((0x387F & 0xe300) | 0x180) | (TEXTCMD_PARAM(cmd) << 10) & 0x3c00;
-      break;
-    default:
-      // This combination is handled when rendering instead of here
-      *dst++ = c;
-      if (TEXTCMD_MULTIBYTE(cmd))
-        *dst++ = *src;
+    if (dd->blk == NULL) {
+      victim = dd;
       break;
     }
-    src += TEXTCMD_MULTIBYTE(cmd);
+    if (dd->last_used < victim->last_used)
+      victim = dd;
+  }
+  free(victim->offs);
+  free(victim->data);
+  DecodedDialogue_Build(victim);
+  victim->last_used = ++g_decoded_dialogue_clock;
+  return victim;
+}
+
+// Perform initial parsing of the string, expanding words, processing some commands, etc.
+void Text_LoadCharacterBuffer() {  // 8ec4e2
+  DecodedDialogue *dd = DecodedDialogue_Get();
+  uint8 *dst = messaging_text_buffer;
+  if (dialogue_message_index < dd->num_messages) {
+    const uint8 *p = dd->data + dd->offs[dialogue_message_index];
+    const uint8 *p_end = dd->data + dd->offs[dialogue_message_index + 1];
+    while (p < p_end) {
+      if (p[0] == kDecodedText_Run) {
+        uint16 len = WORD(p[1]);
+        memcpy(dst, p + 3, len);
+        dst += len, p += 3 + len;
+      } else {
+        dst = Text_RunLoadTimeCmd(Text_DecodeCmd(p[1], &p[2]), dst);
+        p += 3;
+      }
+    }
   }
   *dst = 0x7f;
   dialogue_msg_read_pos = 0;
@@ -2,6 +2,8 @@
 #include <SDL.h>
 #include <SDL2/SDL_video.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "types.h"
 #include "util.h"
@@ -21,6 +23,41 @@ static GlTextureWithSize g_texture;
 static GlslShader *g_glsl_shader;
 static bool g_opengl_es;
 
+// The PPU renders straight into a ring of pixel buffer objects, and the
+// texture is updated from the PBO so glTexSubImage2D doesn't need to copy or
+// stall. Each PBO gets a fence so we never write into one the GPU still reads.
+// Persistent mapping needs ARB_buffer_storage, otherwise the buffer is mapped
+// every frame (GLES 3.0). If neither works the malloc'd buffer is used.
+enum {
+  kPboMode_None,
+  kPboMode_MapEachFrame,
+  kPboMode_Persistent,
+
+  kPboCount = 3,
+};
+
+// Sync objects are core in GL 3.2 and GLES 3.0, but not in the 3.1 loader.
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_WAIT_FAILED 0x911D
+typedef GLsync (GL_APIENTRY *PFN_FenceSync)(GLenum condition, GLbitfield flags);
+typedef GLenum (GL_APIENTRY *PFN_ClientWaitSync)(GLsync sync, GLbitfield flags, uint64 timeout);
+typedef void (GL_APIENTRY *PFN_DeleteSync)(GLsync sync);
+static PFN_FenceSync g_glFenceSync;
+static PFN_ClientWaitSync g_glClientWaitSync;
+static PFN_DeleteSync g_glDeleteSync;
+
+typedef struct PixelBuffer {
+  GLuint buffer;
+  GLsync fence;
+  uint8 *mapped;
+} PixelBuffer;
+
+static uint8 g_pbo_mode;
+static int g_pbo_cur;
+static size_t g_pbo_size;
+static PixelBuffer g_pbos[kPboCount];
+
 static void GL_APIENTRY MessageCallback(GLenum source,
                 GLenum type,
                 GLuint id,
@@ -67,6 +104,17 @@ static bool OpenGLRenderer_Init(SDL_Window *window) {
 
   glGenTextures(1, &g_texture.gl_texture);
 
+  g_glFenceSync = (PFN_FenceSync)SDL_GL_GetProcAddress("glFenceSync");
+  g_glClientWaitSync = (PFN_ClientWaitSync)SDL_GL_GetProcAddress("glClientWaitSync");
+  g_glDeleteSync = (PFN_DeleteSync)SDL_GL_GetProcAddress("glDeleteSync");
+  if (g_glFenceSync && g_glClientWaitSync && g_glDeleteSync && glMapBufferRange && glUnmapBuffer) {
+    g_pbo_mode = (!g_opengl_es && ogl_ext_ARB_buffer_storage == ogl_LOAD_SUCCEEDED && glBufferStorage) ?
+        kPboMode_Persistent : kPboMode_MapEachFrame;
+  }
+  if (kDebugFlag)
+    printf("Texture upload: %s\n", g_pbo_mode == kPboMode_Persistent ? "persistent PBO" :
+                                   g_pbo_mode == kPboMode_MapEachFrame ? "mapped PBO" : "client memory");
+
   static const float kVertices[] = {
     // positions          // texture coords
     -1.0f,  1.0f, 0.0f,   0.0f, 0.0f, // top left
@@ -179,22 +227,98 @@ static bool OpenGLRenderer_Init(SDL_Window *window) {
   return true;
 }
 
+static void PixelBuffers_Free() {
+  for (int i = 0; i < kPboCount; i++) {
+    PixelBuffer *pb = &g_pbos[i];
+    if (pb->fence)
+      g_glDeleteSync(pb->fence);
+    if (pb->mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pb->buffer);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    if (pb->buffer)
+      glDeleteBuffers(1, &pb->buffer);
+    memset(pb, 0, sizeof(*pb));
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  g_pbo_size = 0;
+}
+
+static bool PixelBuffers_Alloc(size_t size) {
+  PixelBuffers_Free();
+  for (int i = 0; i < kPboCount; i++) {
+    PixelBuffer *pb = &g_pbos[i];
+    glGenBuffers(1, &pb->buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pb->buffer);
+    if (g_pbo_mode == kPboMode_Persistent) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+      pb->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+      if (!pb->mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+      }
+    } else {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  g_pbo_size = size;
+  return true;
+}
+
+static uint8 *PixelBuffers_Begin(size_t size) {
+  if (size > g_pbo_size && !PixelBuffers_Alloc(size) &&
+      !(g_pbo_mode == kPboMode_Persistent && (g_pbo_mode = kPboMode_MapEachFrame, PixelBuffers_Alloc(size)))) {
+    fprintf(stderr, "Warning: Unable to map pixel buffers, uploading from client memory\n");
+    PixelBuffers_Free();
+    g_pbo_mode = kPboMode_None;
+    return NULL;
+  }
+  g_pbo_cur = (g_pbo_cur + 1) % kPboCount;
+  PixelBuffer *pb = &g_pbos[g_pbo_cur];
+  if (pb->fence) {
+    // Normally long signaled, since the buffer was used kPboCount frames ago.
+    g_glClientWaitSync(pb->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    g_glDeleteSync(pb->fence);
+    pb->fence = NULL;
+  }
+  if (g_pbo_mode == kPboMode_Persistent)
+    return pb->mapped;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pb->buffer);
+  uint8 *p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (!p) {
+    fprintf(stderr, "Warning: Unable to map pixel buffers, uploading from client memory\n");
+    PixelBuffers_Free();
+    g_pbo_mode = kPboMode_None;
+  }
+  return p;
+}
+
 static void OpenGLRenderer_Destroy() {
+  if (g_pbo_mode != kPboMode_None)
+    PixelBuffers_Free();
 }
 
 static void OpenGLRenderer_BeginDraw(int width, int height, uint8 **pixels, int *pitch) {
   int size = width * height;
 
+  g_draw_width = width;
+  g_draw_height = height;
+  *pitch = width * 4;
+
+  if (g_pbo_mode != kPboMode_None && (*pixels = PixelBuffers_Begin(size * 4)) != NULL)
+    return;
+
   if (size > g_screen_buffer_size) {
     g_screen_buffer_size = size;
     free(g_screen_buffer);
     g_screen_buffer = malloc(size * 4);
   }
 
-  g_draw_width = width;
-  g_draw_height = height;
   *pixels = g_screen_buffer;
-  *pitch = width * 4;
 }
 
 static void OpenGLRenderer_EndDraw() {
@@ -214,19 +338,36 @@ static void OpenGLRenderer_EndDraw() {
   int viewport_x = (drawable_width - viewport_width) >> 1;
   int viewport_y = (viewport_height - viewport_height) >> 1;
 
+  // With a PBO bound, the pixel pointer is an offset into the buffer.
+  const uint8 *pixels = g_screen_buffer;
+  PixelBuffer *pb = NULL;
+  if (g_pbo_mode != kPboMode_None) {
+    pb = &g_pbos[g_pbo_cur];
+    pixels = NULL;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pb->buffer);
+    if (g_pbo_mode == kPboMode_MapEachFrame)
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+
   glBindTexture(GL_TEXTURE_2D, g_texture.gl_texture);
   if (g_draw_width == g_texture.width && g_draw_height == g_texture.height) {
     if (!g_opengl_es)
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_draw_width, g_draw_height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, g_screen_buffer);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_draw_width, g_draw_height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, pixels);
     else
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_draw_width, g_draw_height, GL_BGRA, GL_UNSIGNED_BYTE, g_screen_buffer);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_draw_width, g_draw_height, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
   } else {
     g_texture.width = g_draw_width;
     g_texture.height = g_draw_height;
     if (!g_opengl_es)
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_draw_width, g_draw_height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, g_screen_buffer);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_draw_width, g_draw_height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, pixels);
     else
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_draw_width, g_draw_height, 0, GL_BGRA, GL_UNSIGNED_BYTE, g_screen_buffer);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_draw_width, g_draw_height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+  }
+
+  if (pb) {
+    pb->fence = g_glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Shader LUTs and ImGui fonts upload from client memory.
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   }
 
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -2457,7 +2457,51 @@ static const uint8 *GetOverworldLobytes(int i) {
 }
 
 
-void Overworld_DecompressAndDrawOneQuadrant(uint16 *dst, int screen) {  // 82f595
+// A quadrant only depends on the screen number, so its 32x32 map16 tiles and
+// the WRAM scratch the decoder leaves behind at 0x14000 (interleaved map32
+// words) and 0x14400 (decompressed bytes and map16_decode_*) are kept and
+// replayed on the next visit.
+typedef struct OverworldQuadrantCacheEntry {
+  uint16 *tiles;
+  uint8 *scratch;  // 0x200 bytes for 0x14000, then scratch_hi_size for 0x14400
+  uint16 scratch_hi_size;
+  bool uncacheable;
+} OverworldQuadrantCacheEntry;
+
+static OverworldQuadrantCacheEntry g_ow_quadrant_cache[256];
+static bool g_ow_quadrant_cache_disabled;
+OverworldQuadrantCacheStats g_ow_quadrant_cache_stats;
+
+void OverworldQuadrantCache_SetEnabled(bool enabled) {
+  g_ow_quadrant_cache_disabled = !enabled;
+}
+
+void OverworldQuadrantCache_Clear() {
+  for (int i = 0; i < 256; i++) {
+    OverworldQuadrantCacheEntry *e = &g_ow_quadrant_cache[i];
+    free(e->tiles);
+    free(e->scratch);
+    memset(e, 0, sizeof(*e));
+  }
+}
+
+// Returns the decompressed size, or -1 if the output depends on what was in
+// WRAM before, i.e. a back reference reads bytes the stream didn't write.
+static int OverworldQuadrantCache_DecodedSize(const uint8 *src) {
+  uint8 *a = malloc(0x10000), *b = malloc(0x10000);
+  if (!a || !b)
+    Die("Out of memory");
+  memset(a, 0x00, 0x10000);
+  memset(b, 0xff, 0x10000);
+  int len = Decompress_bank02(a, src);
+  if (len != Decompress_bank02(b, src) || memcmp(a, b, len) != 0)
+    len = -1;
+  free(a);
+  free(b);
+  return len;
+}
+
+static void Overworld_DecompressAndDrawOneQuadrantUncached(uint16 *dst, int screen) {
   Decompress_bank02(g_ram_access(0x14400), GetOverworldHibytes(screen));
   for (int i = 0; i < 256; i++)
     *(g_ram_access(0x14001 + i * 2)) = *(g_ram_access(0x14400 + i));
@@ -2478,6 +2522,40 @@ void Overworld_DecompressAndDrawOneQuadrant(uint16 *dst, int screen) {  // 82f59
   }
 }
 
+void Overworld_DecompressAndDrawOneQuadrant(uint16 *dst, int screen) {  // 82f595
+  OverworldQuadrantCacheEntry *e = &g_ow_quadrant_cache[screen & 0xff];
+  if (g_ow_quadrant_cache_disabled || screen != (screen & 0xff) || e->uncacheable) {
+    Overworld_DecompressAndDrawOneQuadrantUncached(dst, screen);
+    return;
+  }
+  if (e->tiles) {
+    g_ow_quadrant_cache_stats.hits++;
+    for (int y = 0; y < 32; y++)
+      memcpy(dst + y * 64, e->tiles + y * 32, 32 * sizeof(uint16));
+    memcpy(g_ram_access(0x14000), e->scratch, 0x200);
+    memcpy(g_ram_access(0x14400), e->scratch + 0x200, e->scratch_hi_size);
+    return;
+  }
+  g_ow_quadrant_cache_stats.misses++;
+  Overworld_DecompressAndDrawOneQuadrantUncached(dst, screen);
+  int hi_size = OverworldQuadrantCache_DecodedSize(GetOverworldHibytes(screen));
+  int lo_size = OverworldQuadrantCache_DecodedSize(GetOverworldLobytes(screen));
+  // Shorter streams would leave old bytes between the map16_decode_* arrays.
+  if (hi_size < 0x44 || lo_size < 0x44) {
+    e->uncacheable = true;
+    return;
+  }
+  e->scratch_hi_size = IntMax(hi_size, lo_size);
+  e->tiles = malloc(32 * 32 * sizeof(uint16));
+  e->scratch = malloc(0x200 + e->scratch_hi_size);
+  if (!e->tiles || !e->scratch)
+    Die("Out of memory");
+  for (int y = 0; y < 32; y++)
+    memcpy(e->tiles + y * 32, dst + y * 64, 32 * sizeof(uint16));
+  memcpy(e->scratch, g_ram_access(0x14000), 0x200);
+  memcpy(e->scratch + 0x200, g_ram_access(0x14400), e->scratch_hi_size);
+}
+
 void Overworld_ParseMap32Definition(uint16 *dst, uint16 input) {  // 82f691
   uint16 a = input & ~7;
   if (a != map16_decode_last) {
@@ -2603,53 +2681,7 @@ void DecompressEnemyDamageSubclasses() {  // 82fe71
 }
 
 int Decompress_bank02(uint8 *dst, const uint8 *src) {  // 82febb
-  uint8 *dst_org = dst;
-  int len;
-  for (;;) {
-    uint8 cmd = *src++;
-    if (cmd == 0xff)
-      return dst - dst_org;
-    if ((cmd & 0xe0) != 0xe0) {
-      len = (cmd & 0x1f) + 1;
-      cmd &= 0xe0;
-    } else {
-      len = *src++;
-      len += ((cmd & 3) << 8) + 1;
-      cmd = (cmd << 3) & 0xe0;
-    }
-    //printf("%d: %d,%d\n", (int)(dst - dst_org), cmd, len);
-    if (cmd == 0) {
-      do {
-        *dst++ = *src++;
-      } while (--len);
-    } else if (cmd & 0x80) {
-      uint32 offs = *src++ << 8;
-      offs |= *src++;
-      do {
-        *dst++ = dst_org[offs++];
-      } while (--len);
-    } else if (!(cmd & 0x40)) {
-      uint8 v = *src++;
-      do {
-        *dst++ = v;
-      } while (--len);
-    } else if (!(cmd & 0x20)) {
-      uint8 lo = *src++;
-      uint8 hi = *src++;
-      do {
-        *dst++ = lo;
-        if (--len == 0)
-          break;
-        *dst++ = hi;
-      } while (--len);
-    } else {
-      // copy bytes with the byte incrementing by 1 in between
-      uint8 v = *src++;
-      do {
-        *dst++ = v;
-      } while (v++, --len);
-    }
-  }
+  return LzDecompress(dst, src, true);
 }
 
 uint8 Overworld_ReadTileAttribute(uint16 x, uint16 y) {  // 85faa2
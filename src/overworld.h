@@ -123,6 +123,12 @@ uint16 *BufferAndBuildMap16Stripes_X(uint16 *dst);
 uint16 *BufferAndBuildMap16Stripes_Y(uint16 *dst);
 void Overworld_DecompressAndDrawAllQuadrants();
 void Overworld_DecompressAndDrawOneQuadrant(uint16 *dst, int screen);
+typedef struct OverworldQuadrantCacheStats {
+  uint32 hits, misses;
+} OverworldQuadrantCacheStats;
+extern OverworldQuadrantCacheStats g_ow_quadrant_cache_stats;
+void OverworldQuadrantCache_SetEnabled(bool enabled);
+void OverworldQuadrantCache_Clear();
 void Overworld_ParseMap32Definition(uint16 *dst, uint16 input);
 void OverworldLoad_LoadSubOverlayMap32();
 void LoadOverworldOverlay();
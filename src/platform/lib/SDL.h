@@ -0,0 +1,146 @@
+// Stands in for <SDL.h> when building libzelda3. Outside of main.c and the
+// renderers the game only needs threads, mutexes, atomics and timers from SDL,
+// so those map onto pthreads and the gcc atomic builtins here. Everything is
+// static inline so the library neither links nor exports any SDL symbols.
+#ifndef ZELDA3_PLATFORM_LIB_SDL_H_
+#define ZELDA3_PLATFORM_LIB_SDL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "SDL_keycode.h"
+
+typedef enum { SDL_FALSE = 0, SDL_TRUE = 1 } SDL_bool;
+typedef struct SDL_atomic_t { int value; } SDL_atomic_t;
+typedef int (*SDL_ThreadFunction)(void *data);
+typedef struct SDL_Thread {
+  pthread_t thread;
+  SDL_ThreadFunction fn;
+  void *data;
+} SDL_Thread;
+typedef struct SDL_mutex { pthread_mutex_t m; } SDL_mutex;
+typedef struct SDL_cond { pthread_cond_t c; } SDL_cond;
+
+#define SDL_MUTEX_TIMEDOUT 1
+
+static inline int SDL_AtomicGet(SDL_atomic_t *a) {
+  return __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+}
+
+static inline int SDL_AtomicSet(SDL_atomic_t *a, int v) {
+  return __atomic_exchange_n(&a->value, v, __ATOMIC_SEQ_CST);
+}
+
+static inline int SDL_AtomicAdd(SDL_atomic_t *a, int v) {
+  return __atomic_fetch_add(&a->value, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void *SDL_AtomicGetPtr(void **a) {
+  return __atomic_load_n(a, __ATOMIC_SEQ_CST);
+}
+
+static inline SDL_bool SDL_AtomicCASPtr(void **a, void *oldval, void *newval) {
+  return __atomic_compare_exchange_n(a, &oldval, newval, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? SDL_TRUE : SDL_FALSE;
+}
+
+static inline uint64_t SDL_GetPerformanceCounter(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t SDL_GetPerformanceFrequency(void) {
+  return 1000000000;
+}
+
+static inline void SDL_Delay(uint32_t ms) {
+  struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+  nanosleep(&ts, NULL);
+}
+
+static inline SDL_mutex *SDL_CreateMutex(void) {
+  SDL_mutex *m = (SDL_mutex *)malloc(sizeof(SDL_mutex));
+  if (m && pthread_mutex_init(&m->m, NULL) != 0) {
+    free(m);
+    m = NULL;
+  }
+  return m;
+}
+
+static inline int SDL_LockMutex(SDL_mutex *m) {
+  return m ? pthread_mutex_lock(&m->m) : -1;
+}
+
+static inline int SDL_UnlockMutex(SDL_mutex *m) {
+  return m ? pthread_mutex_unlock(&m->m) : -1;
+}
+
+static inline void SDL_DestroyMutex(SDL_mutex *m) {
+  if (!m)
+    return;
+  pthread_mutex_destroy(&m->m);
+  free(m);
+}
+
+static inline SDL_cond *SDL_CreateCond(void) {
+  SDL_cond *c = (SDL_cond *)malloc(sizeof(SDL_cond));
+  if (c && pthread_cond_init(&c->c, NULL) != 0) {
+    free(c);
+    c = NULL;
+  }
+  return c;
+}
+
+static inline void SDL_DestroyCond(SDL_cond *c) {
+  if (!c)
+    return;
+  pthread_cond_destroy(&c->c);
+  free(c);
+}
+
+static inline int SDL_CondSignal(SDL_cond *c) {
+  return c ? pthread_cond_signal(&c->c) : -1;
+}
+
+static inline int SDL_CondWaitTimeout(SDL_cond *c, SDL_mutex *m, uint32_t ms) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += ms / 1000;
+  ts.tv_nsec += (long)(ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000)
+    ts.tv_sec++, ts.tv_nsec -= 1000000000;
+  int r = pthread_cond_timedwait(&c->c, &m->m, &ts);
+  return r == 0 ? 0 : SDL_MUTEX_TIMEDOUT;
+}
+
+static inline void *SDL_ThreadEntry(void *arg) {
+  SDL_Thread *t = (SDL_Thread *)arg;
+  return (void *)(intptr_t)t->fn(t->data);
+}
+
+static inline SDL_Thread *SDL_CreateThread(SDL_ThreadFunction fn, const char *name, void *data) {
+  SDL_Thread *t = (SDL_Thread *)malloc(sizeof(SDL_Thread));
+  if (!t)
+    return NULL;
+  t->fn = fn;
+  t->data = data;
+  if (pthread_create(&t->thread, NULL, &SDL_ThreadEntry, t) != 0) {
+    free(t);
+    return NULL;
+  }
+  (void)name;
+  return t;
+}
+
+static inline void SDL_WaitThread(SDL_Thread *t, int *status) {
+  void *ret = NULL;
+  if (!t)
+    return;
+  pthread_join(t->thread, &ret);
+  if (status)
+    *status = (int)(intptr_t)ret;
+  free(t);
+}
+
+#endif  // ZELDA3_PLATFORM_LIB_SDL_H_
@@ -0,0 +1,11 @@
+// Stands in for <SDL_keycode.h> when building libzelda3, see SDL.h. The
+// library has no keyboard, config.h only needs the types.
+#ifndef ZELDA3_PLATFORM_LIB_SDL_KEYCODE_H_
+#define ZELDA3_PLATFORM_LIB_SDL_KEYCODE_H_
+
+#include <stdint.h>
+
+typedef int32_t SDL_Keycode;
+typedef int SDL_Keymod;
+
+#endif  // ZELDA3_PLATFORM_LIB_SDL_KEYCODE_H_
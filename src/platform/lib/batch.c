@@ -0,0 +1,343 @@
+// Steps many games in lockstep. The game keeps all of its state in globals,
+// so each worker is a forked process with its own copy of the game. Env
+// states live in shared memory and get swapped in and out of the workers with
+// savestates, except when there's one env per worker and they never move.
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include "libzelda3.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#include "src/audio.h"
+#include "src/variables.h"
+#include "src/zelda_rtl.h"
+
+enum {
+  kBatchMaxWorkers = 256,
+  kBatchNoEnv = -1,
+};
+
+// Envs are handed out in contiguous ranges, one per worker. A worker that
+// runs out of its own range takes envs from the ranges of the others.
+typedef struct BatchQueue {
+  int next, end;
+  uint8 pad[56];
+} BatchQueue;
+
+typedef struct BatchShared {
+  pthread_mutex_t mutex;
+  pthread_cond_t start_cond, done_cond;
+  uint32 generation;
+  int workers_done;
+  bool quit;
+  bool want_frames;
+  int frames;
+  BatchQueue queues[kBatchMaxWorkers];
+} BatchShared;
+
+struct Zelda3Batch {
+  int num_envs, num_workers;
+  bool swap_states;
+  Zelda3RamRange *ram_ranges;
+  int num_ram_ranges;
+  int frame_width, frame_height, frame_channels;
+  size_t ram_obs_size, frame_obs_size, state_size;
+  pid_t pids[kBatchMaxWorkers];
+
+  BatchShared *shared;
+  size_t shared_size;
+  // All of these point into the shared mapping.
+  uint16 *inputs;
+  // Which worker has the env loaded, plus one. Zero when the state in shared
+  // memory is the only copy.
+  uint16 *holder;
+  Zelda3EnvInfo *info;
+  uint8 *ram_obs;
+  uint8 *frame_obs;
+  uint8 *states;
+};
+
+static size_t AlignUp(size_t v) {
+  return (v + 63) & ~(size_t)63;
+}
+
+static void Batch_StepEnv(Zelda3Batch *b, int worker, int env, int *held_env) {
+  BatchShared *sh = b->shared;
+  uint8 *state = b->states + env * b->state_size;
+  if (*held_env != env || b->holder[env] != worker + 1) {
+    ZeldaLoadState(state, b->state_size);
+    b->holder[env] = worker + 1;
+  }
+  *held_env = env;
+  const uint16 *in = &b->inputs[env * 2];
+  Zelda3_RunFrames(in[0], in[1], sh->frames, 0, NULL);
+  // Only the last frame gets drawn.
+  if (sh->want_frames) {
+    ZeldaDrawPpuObservation(b->frame_obs + env * b->frame_obs_size,
+                            b->frame_width, b->frame_height, b->frame_channels);
+  }
+  uint8 *dst = b->ram_obs + env * b->ram_obs_size;
+  for (int i = 0; i < b->num_ram_ranges; i++) {
+    memcpy(dst, g_ram_access(b->ram_ranges[i].addr), b->ram_ranges[i].size);
+    dst += b->ram_ranges[i].size;
+  }
+  // The field names are macros from variables.h, so fill it in by position.
+  b->info[env] = (Zelda3EnvInfo){
+    main_module_index, submodule_index, link_health_current, link_health_capacity,
+    link_rupees_goal, overworld_screen_index, dungeon_room_index,
+    link_x_coord, link_y_coord, player_is_indoors,
+  };
+  if (b->swap_states)
+    ZeldaSaveState(state);
+}
+
+static int Batch_ClaimEnv(Zelda3Batch *b, int worker) {
+  // Envs that never get saved can't move to another worker.
+  int num_queues = b->swap_states ? b->num_workers : 1;
+  for (int i = 0; i < num_queues; i++) {
+    BatchQueue *q = &b->shared->queues[(worker + i) % b->num_workers];
+    if (__atomic_load_n(&q->next, __ATOMIC_RELAXED) >= q->end)
+      continue;
+    int env = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+    if (env < q->end)
+      return env;
+  }
+  return kBatchNoEnv;
+}
+
+static void NORETURN Batch_WorkerMain(Zelda3Batch *b, int worker) {
+  BatchShared *sh = b->shared;
+  int held_env = kBatchNoEnv;
+  uint32 generation = 0;
+  for (;;) {
+    pthread_mutex_lock(&sh->mutex);
+    while (sh->generation == generation && !sh->quit)
+      pthread_cond_wait(&sh->start_cond, &sh->mutex);
+    generation = sh->generation;
+    bool quit = sh->quit;
+    pthread_mutex_unlock(&sh->mutex);
+    if (quit)
+      _exit(0);
+
+    for (int env; (env = Batch_ClaimEnv(b, worker)) != kBatchNoEnv; )
+      Batch_StepEnv(b, worker, env, &held_env);
+
+    pthread_mutex_lock(&sh->mutex);
+    if (++sh->workers_done == b->num_workers)
+      pthread_cond_signal(&sh->done_cond);
+    pthread_mutex_unlock(&sh->mutex);
+  }
+}
+
+static void Batch_PinToCpu(int worker) {
+#if defined(__linux__)
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus <= 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(worker % num_cpus, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)worker;
+#endif
+}
+
+Zelda3Batch *Zelda3Batch_Create(const Zelda3BatchConfig *config) {
+  int num_workers = config->num_workers;
+  if (num_workers <= 0)
+    num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  num_workers = num_workers < config->num_envs ? num_workers : config->num_envs;
+  int fw = config->frame_width, fh = config->frame_height, fc = config->frame_channels;
+  if (config->num_envs <= 0 || num_workers <= 0 || num_workers > kBatchMaxWorkers ||
+      fw != 0 && (fw < 0 || fw > kZelda3_ScreenWidth || fh <= 0 || fh > kZelda3_ScreenHeight ||
+                  !(fc == 1 || fc == 3)))
+    return NULL;
+
+  Zelda3Batch *b = calloc(1, sizeof(Zelda3Batch));
+  if (!b)
+    Die("Out of memory");
+  b->num_envs = config->num_envs;
+  b->num_workers = num_workers;
+  b->swap_states = config->num_envs > num_workers;
+  b->num_ram_ranges = config->num_ram_ranges;
+  b->ram_ranges = malloc(sizeof(Zelda3RamRange) * (config->num_ram_ranges + 1));
+  if (!b->ram_ranges)
+    Die("Out of memory");
+  for (int i = 0; i < config->num_ram_ranges; i++) {
+    Zelda3RamRange r = config->ram_ranges[i];
+    if (r.addr > kZelda3_RamSize || r.size > kZelda3_RamSize - r.addr) {
+      free(b->ram_ranges);
+      free(b);
+      return NULL;
+    }
+    b->ram_ranges[i] = r;
+    b->ram_obs_size += r.size;
+  }
+  b->frame_width = fw;
+  b->frame_height = fw ? fh : 0;
+  b->frame_channels = fw ? fc : 0;
+  b->frame_obs_size = (size_t)b->frame_width * b->frame_height * b->frame_channels;
+  b->state_size = ZeldaGetStateSize();
+
+  size_t n = b->num_envs;
+  size_t offs_inputs = AlignUp(sizeof(BatchShared));
+  size_t offs_holder = offs_inputs + AlignUp(n * 2 * sizeof(uint16));
+  size_t offs_info = offs_holder + AlignUp(n * sizeof(uint16));
+  size_t offs_ram = offs_info + AlignUp(n * sizeof(Zelda3EnvInfo));
+  size_t offs_frames = offs_ram + AlignUp(n * b->ram_obs_size);
+  size_t offs_states = offs_frames + AlignUp(n * b->frame_obs_size);
+  b->shared_size = offs_states + n * b->state_size;
+  uint8 *mem = mmap(NULL, b->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    Die("Unable to map batch memory");
+  b->shared = (BatchShared *)mem;
+  b->inputs = (uint16 *)(mem + offs_inputs);
+  b->holder = (uint16 *)(mem + offs_holder);
+  b->info = (Zelda3EnvInfo *)(mem + offs_info);
+  b->ram_obs = mem + offs_ram;
+  b->frame_obs = mem + offs_frames;
+  b->states = mem + offs_states;
+
+  BatchShared *sh = b->shared;
+  pthread_mutexattr_t ma;
+  pthread_mutexattr_init(&ma);
+  pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&sh->mutex, &ma);
+  pthread_mutexattr_destroy(&ma);
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&sh->start_cond, &ca);
+  pthread_cond_init(&sh->done_cond, &ca);
+  pthread_condattr_destroy(&ca);
+
+  // Every env starts out from the current state of the calling process.
+  ZeldaSaveState(b->states);
+  for (size_t i = 1; i < n; i++)
+    memcpy(b->states + i * b->state_size, b->states, b->state_size);
+
+  ZeldaShutdownMsu();
+  fflush(stdout);
+  fflush(stderr);
+  for (int w = 0; w < num_workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0)
+      Die("Unable to fork batch worker");
+    if (pid == 0) {
+      if (config->pin_workers)
+        Batch_PinToCpu(w);
+      Batch_WorkerMain(b, w);
+    }
+    b->pids[w] = pid;
+  }
+  return b;
+}
+
+void Zelda3Batch_Destroy(Zelda3Batch *b) {
+  if (!b)
+    return;
+  BatchShared *sh = b->shared;
+  pthread_mutex_lock(&sh->mutex);
+  sh->quit = true;
+  pthread_cond_broadcast(&sh->start_cond);
+  pthread_mutex_unlock(&sh->mutex);
+  for (int w = 0; w < b->num_workers; w++)
+    waitpid(b->pids[w], NULL, 0);
+  munmap(b->shared, b->shared_size);
+  free(b->ram_ranges);
+  free(b);
+}
+
+int Zelda3Batch_GetNumWorkers(Zelda3Batch *b) {
+  return b->num_workers;
+}
+
+size_t Zelda3Batch_GetRamObsSize(Zelda3Batch *b) {
+  return b->ram_obs_size;
+}
+
+size_t Zelda3Batch_GetFrameObsSize(Zelda3Batch *b, int *width, int *height) {
+  if (width)
+    *width = b->frame_width;
+  if (height)
+    *height = b->frame_height;
+  return b->frame_obs_size;
+}
+
+bool Zelda3Batch_SetState(Zelda3Batch *b, int env, const void *state, size_t size) {
+  if (env < 0 || env >= b->num_envs || size != b->state_size)
+    return false;
+  memcpy(b->states + env * b->state_size, state, size);
+  b->holder[env] = 0;
+  return true;
+}
+
+bool Zelda3Batch_GetState(Zelda3Batch *b, int env, void *state, size_t size) {
+  // Without swapping, the latest state only exists inside the worker.
+  if (env < 0 || env >= b->num_envs || size != b->state_size || !b->swap_states)
+    return false;
+  memcpy(state, b->states + env * b->state_size, size);
+  return true;
+}
+
+// Waits for the workers to finish the step, and dies if one of them died
+// rather than waiting forever.
+static void Batch_WaitForWorkers(Zelda3Batch *b) {
+  BatchShared *sh = b->shared;
+  pthread_mutex_lock(&sh->mutex);
+  while (sh->workers_done != b->num_workers) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += 100000000;
+    if (ts.tv_nsec >= 1000000000)
+      ts.tv_sec++, ts.tv_nsec -= 1000000000;
+    if (pthread_cond_timedwait(&sh->done_cond, &sh->mutex, &ts) == 0)
+      continue;
+    for (int w = 0; w < b->num_workers; w++) {
+      if (waitpid(b->pids[w], NULL, WNOHANG) == b->pids[w])
+        Die("Batch worker exited");
+    }
+  }
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+void Zelda3Batch_Step(Zelda3Batch *b, const uint16_t *inputs, int frames,
+                      uint8_t *ram_obs, uint8_t *frame_obs, Zelda3EnvInfo *info) {
+  BatchShared *sh = b->shared;
+  memcpy(b->inputs, inputs, b->num_envs * 2 * sizeof(uint16));
+  int per_worker = b->num_envs / b->num_workers, extra = b->num_envs % b->num_workers;
+  for (int w = 0, start = 0; w < b->num_workers; w++) {
+    int count = per_worker + (w < extra);
+    sh->queues[w].next = start;
+    sh->queues[w].end = start + count;
+    start += count;
+  }
+  pthread_mutex_lock(&sh->mutex);
+  sh->frames = frames;
+  sh->want_frames = frame_obs && b->frame_obs_size;
+  sh->workers_done = 0;
+  sh->generation++;
+  pthread_cond_broadcast(&sh->start_cond);
+  pthread_mutex_unlock(&sh->mutex);
+
+  Batch_WaitForWorkers(b);
+
+  if (ram_obs)
+    memcpy(ram_obs, b->ram_obs, b->num_envs * b->ram_obs_size);
+  if (frame_obs)
+    memcpy(frame_obs, b->frame_obs, b->num_envs * b->frame_obs_size);
+  if (info)
+    memcpy(info, b->info, b->num_envs * sizeof(Zelda3EnvInfo));
+}
@@ -0,0 +1,166 @@
+#include "libzelda3.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "src/asset_loader.h"
+#include "src/audio.h"
+#include "src/config.h"
+#include "src/zelda_rtl.h"
+#include "src/ext/GameRAM.h"
+#include "snes/ppu.h"
+
+// The rest of the game expects these from main.c.
+Config g_config;
+
+static int g_audio_samples;
+
+void NORETURN Die(const char *error) {
+  fprintf(stderr, "Error: %s\n", error);
+  exit(1);
+}
+
+// All calls come from one thread, so the audio state needs no lock.
+void ZeldaApuLock() {
+}
+
+void ZeldaApuUnlock() {
+}
+
+void Zelda3_Init(const char *assets_path, int audio_freq) {
+  LoadAssets(assets_path ? assets_path : "zelda3_assets.dat");
+  ZeldaInitialize();
+  // Frames are always 256 pixels wide, without the widescreen sides.
+  g_zenv.ppu->extraLeftRight = 0;
+  ZeldaSetAudioOutputFreq(audio_freq);
+  g_audio_samples = 534 * audio_freq / 32000;
+  ZeldaSetLanguage(NULL);
+}
+
+void Zelda3_Reset(bool preserve_sram) {
+  ZeldaReset(preserve_sram);
+}
+
+bool Zelda3_LoadSaveFile(const char *path) {
+  return SaveLoadFile(kSaveLoad_Load, path);
+}
+
+bool Zelda3_RunFrame(uint16_t input1, uint16_t input2) {
+  return ZeldaRunFrame(input1, input2);
+}
+
+bool Zelda3_RunFrames(uint16_t input1, uint16_t input2, int n, uint32_t flags,
+                      const Zelda3FrameOutput *out) {
+  ZeldaFrameOutput o = {
+    .render_flags = kPpuRenderFlags_NewRenderer,
+    .audio_samples = g_audio_samples,
+    .audio_channels = 2,
+  };
+  if (out) {
+    o.pixels = out->pixels;
+    o.pitch = out->pitch;
+    o.audio = out->audio;
+    o.audio_channels = out->audio_channels;
+    o.hashes = out->hashes;
+  }
+  return ZeldaRunFrames(input1, input2, n, flags, &o);
+}
+
+uint64_t Zelda3_GetStateHash(void) {
+  return ZeldaGetStateHash();
+}
+
+void Zelda3_DrawFrame(uint8_t *pixels, size_t pitch) {
+  ZeldaDrawPpuFrame(pixels, pitch, kPpuRenderFlags_NewRenderer);
+}
+
+bool Zelda3_DrawObservation(uint8_t *pixels, int width, int height, int channels) {
+  if (width <= 0 || width > kZelda3_ScreenWidth || height <= 0 || height > kZelda3_ScreenHeight ||
+      !(channels == 1 || channels == 3))
+    return false;
+  ZeldaDrawPpuObservation(pixels, width, height, channels);
+  return true;
+}
+
+void Zelda3_RenderAudio(int16_t *samples, int num_samples, int channels) {
+  ZeldaRenderAudio(samples, num_samples, channels);
+}
+
+uint8_t *Zelda3_GetRam(void) {
+  return g_ram_access(0);
+}
+
+bool Zelda3_ReadRam(uint32_t addr, void *dst, size_t size) {
+  if (addr > kZelda3_RamSize || size > kZelda3_RamSize - addr)
+    return false;
+  memcpy(dst, g_ram_access(addr), size);
+  return true;
+}
+
+bool Zelda3_WriteRam(uint32_t addr, const void *src, size_t size) {
+  if (addr > kZelda3_RamSize || size > kZelda3_RamSize - addr)
+    return false;
+  memcpy(g_ram_access(addr), src, size);
+  return true;
+}
+
+static const uint8 kFeatureTypeSize[4] = { 1, 1, 2, 2 };
+
+size_t Zelda3_GetFeatureCount(const Zelda3Feature *features, int num_features) {
+  size_t total = 0;
+  for (int i = 0; i < num_features; i++) {
+    const Zelda3Feature *f = &features[i];
+    if (f->type >= countof(kFeatureTypeSize))
+      return 0;
+    uint32 count = f->count ? f->count : 1, size = kFeatureTypeSize[f->type];
+    uint32 stride = f->stride ? f->stride : size;
+    if (f->addr >= kZelda3_RamSize || (count - 1) * stride + size > kZelda3_RamSize - f->addr)
+      return 0;
+    total += count;
+  }
+  return total;
+}
+
+// Writes either floats or clamped bytes, whichever |fdst| or |bdst| is set.
+static void ReadFeatures(const Zelda3Feature *features, int num_features, float *fdst, uint8 *bdst) {
+  for (int i = 0; i < num_features; i++) {
+    const Zelda3Feature *f = &features[i];
+    const uint8 *p = g_ram_access(f->addr);
+    uint32 count = f->count ? f->count : 1;
+    uint32 stride = f->stride ? f->stride : kFeatureTypeSize[f->type];
+    float scale = f->scale ? f->scale : 1.0f;
+    for (uint32 j = 0; j < count; j++, p += stride) {
+      int v;
+      switch (f->type) {
+      case kZelda3_Feature_U8: v = p[0]; break;
+      case kZelda3_Feature_S8: v = (int8)p[0]; break;
+      case kZelda3_Feature_U16: v = p[0] | p[1] << 8; break;
+      default: v = (int16)(p[0] | p[1] << 8); break;
+      }
+      float value = v * scale;
+      if (fdst)
+        *fdst++ = value;
+      else
+        *bdst++ = value <= 0 ? 0 : value >= 255 ? 255 : (uint8)(value + 0.5f);
+    }
+  }
+}
+
+void Zelda3_ReadFeatures(const Zelda3Feature *features, int num_features, float *dst) {
+  ReadFeatures(features, num_features, dst, NULL);
+}
+
+void Zelda3_ReadFeaturesU8(const Zelda3Feature *features, int num_features, uint8_t *dst) {
+  ReadFeatures(features, num_features, NULL, dst);
+}
+
+size_t Zelda3_GetStateSize(void) {
+  return ZeldaGetStateSize();
+}
+
+void Zelda3_SaveState(void *dst) {
+  ZeldaSaveState((uint8 *)dst);
+}
+
+bool Zelda3_LoadState(const void *src, size_t size) {
+  return ZeldaLoadState((const uint8 *)src, size);
+}
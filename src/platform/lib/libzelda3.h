@@ -0,0 +1,265 @@
+// C interface for embedding the game in other programs, like bots and
+// analysis tools. It drives the same code as the zelda3 binary, minus the
+// window, input and audio devices. There is one game per process and the
+// calls must all come from the same thread.
+#ifndef ZELDA3_LIBZELDA3_H_
+#define ZELDA3_LIBZELDA3_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define ZELDA3_API __declspec(dllexport)
+#else
+#define ZELDA3_API __attribute__((visibility("default")))
+#endif
+
+enum {
+  kZelda3_ScreenWidth = 256,
+  kZelda3_ScreenHeight = 224,
+  kZelda3_RamSize = 0x20000,
+
+  // Joypad bits for Zelda3_RunFrame.
+  kZelda3_Button_B = 1 << 0,
+  kZelda3_Button_Y = 1 << 1,
+  kZelda3_Button_Select = 1 << 2,
+  kZelda3_Button_Start = 1 << 3,
+  kZelda3_Button_Up = 1 << 4,
+  kZelda3_Button_Down = 1 << 5,
+  kZelda3_Button_Left = 1 << 6,
+  kZelda3_Button_Right = 1 << 7,
+  kZelda3_Button_A = 1 << 8,
+  kZelda3_Button_X = 1 << 9,
+  kZelda3_Button_L = 1 << 10,
+  kZelda3_Button_R = 1 << 11,
+};
+
+// Loads the assets and powers on the game. |assets_path| defaults to
+// zelda3_assets.dat in the current directory when NULL. |audio_freq| is the
+// rate Zelda3_RenderAudio produces. Fatal errors exit the process.
+ZELDA3_API void Zelda3_Init(const char *assets_path, int audio_freq);
+ZELDA3_API void Zelda3_Reset(bool preserve_sram);
+// Loads a .sav file written by the game, like saves/save1.sav.
+ZELDA3_API bool Zelda3_LoadSaveFile(const char *path);
+
+// Runs one frame with the joypads of both players. Returns true while a
+// replay loaded from a save file is still playing.
+ZELDA3_API bool Zelda3_RunFrame(uint16_t input1, uint16_t input2);
+// Runs |n| frames holding the same inputs, like bots repeating an action.
+// The frames before the last skip drawing and audio samples but still run
+// the music driver and the PPU register writes, which the game state depends
+// on. Use this rather than Zelda3_RunFrame when not calling
+// Zelda3_RenderAudio every frame.
+enum {
+  // Draw and play every frame, to compare against elision.
+  kZelda3_RunFrames_NoElision = 1,
+};
+
+typedef struct Zelda3FrameOutput {
+  uint8_t *pixels;  // last frame as Zelda3_DrawFrame draws it, or NULL
+  size_t pitch;
+  int16_t *audio;  // last frame as Zelda3_RenderAudio renders it, or NULL
+  int audio_channels;
+  uint64_t *hashes;  // Zelda3_GetStateHash after each of the frames, or NULL
+} Zelda3FrameOutput;
+
+ZELDA3_API bool Zelda3_RunFrames(uint16_t input1, uint16_t input2, int n, uint32_t flags,
+                                 const Zelda3FrameOutput *out);
+// FNV-1a of the 128KB of RAM followed by the 64KB of VRAM.
+ZELDA3_API uint64_t Zelda3_GetStateHash(void);
+// Renders the current frame as kZelda3_ScreenWidth x kZelda3_ScreenHeight
+// 32-bit XRGB pixels. Only needed for frames that get looked at.
+ZELDA3_API void Zelda3_DrawFrame(uint8_t *pixels, size_t pitch);
+// Renders the current frame straight into a small observation, 84x84 gray
+// (channels 1) or 128x112 RGB (channels 3) and the like. Only the lines that
+// end up in it get drawn. Returns false if it's larger than the screen.
+ZELDA3_API bool Zelda3_DrawObservation(uint8_t *pixels, int width, int height, int channels);
+// Produces the audio of one frame, which is 534 * audio_freq / 32000 samples.
+ZELDA3_API void Zelda3_RenderAudio(int16_t *samples, int num_samples, int channels);
+
+// The game's 128KB of WRAM, for direct reads and writes between frames.
+ZELDA3_API uint8_t *Zelda3_GetRam(void);
+ZELDA3_API bool Zelda3_ReadRam(uint32_t addr, void *dst, size_t size);
+ZELDA3_API bool Zelda3_WriteRam(uint32_t addr, const void *src, size_t size);
+
+// Features are RAM variables gathered into a vector, for example the 16
+// sprite states at 0xdd0 or Link's coordinates at 0x20 and 0x22.
+enum {
+  kZelda3_Feature_U8,
+  kZelda3_Feature_S8,
+  kZelda3_Feature_U16,
+  kZelda3_Feature_S16,
+};
+
+typedef struct Zelda3Feature {
+  uint32_t addr;
+  uint16_t count;  // number of values, 0 counts as 1
+  uint8_t type;
+  uint8_t stride;  // bytes between values, 0 when they're back to back
+  float scale;     // 0 counts as 1
+} Zelda3Feature;
+
+// Returns the number of values the features produce, or 0 if one of them
+// is outside of RAM.
+ZELDA3_API size_t Zelda3_GetFeatureCount(const Zelda3Feature *features, int num_features);
+// Writes value * scale for all the features. The uint8 version clamps them
+// to 0..255.
+ZELDA3_API void Zelda3_ReadFeatures(const Zelda3Feature *features, int num_features, float *dst);
+ZELDA3_API void Zelda3_ReadFeaturesU8(const Zelda3Feature *features, int num_features, uint8_t *dst);
+
+// Snapshots of the whole machine in caller memory, for branching and
+// rewinding. All snapshots have the same size.
+ZELDA3_API size_t Zelda3_GetStateSize(void);
+ZELDA3_API void Zelda3_SaveState(void *dst);
+ZELDA3_API bool Zelda3_LoadState(const void *src, size_t size);
+
+// Batches step many envs per call on a pool of worker processes, for
+// training agents. The workers are forked from the caller, so Zelda3_Init
+// must come first and the caller's game is the starting state of every env.
+typedef struct Zelda3Batch Zelda3Batch;
+
+typedef struct Zelda3RamRange {
+  uint32_t addr, size;
+} Zelda3RamRange;
+
+typedef struct Zelda3BatchConfig {
+  int num_envs;
+  int num_workers;  // 0 means one per cpu
+  bool pin_workers;
+  // Slices of RAM that get copied out after every step, back to back.
+  const Zelda3RamRange *ram_ranges;
+  int num_ram_ranges;
+  // Frames as drawn by Zelda3_DrawObservation. A width of 0 disables them.
+  int frame_width, frame_height, frame_channels;
+} Zelda3BatchConfig;
+
+// Game variables that are handy for rewards, read after every step.
+typedef struct Zelda3EnvInfo {
+  uint8_t main_module_index, submodule_index;
+  uint8_t link_health_current, link_health_capacity;
+  uint16_t link_rupees_goal;
+  uint16_t overworld_screen_index, dungeon_room_index;
+  uint16_t link_x_coord, link_y_coord;
+  uint8_t player_is_indoors, pad;
+} Zelda3EnvInfo;
+
+// Returns NULL if the config is invalid.
+ZELDA3_API Zelda3Batch *Zelda3Batch_Create(const Zelda3BatchConfig *config);
+ZELDA3_API void Zelda3Batch_Destroy(Zelda3Batch *b);
+ZELDA3_API int Zelda3Batch_GetNumWorkers(Zelda3Batch *b);
+// Bytes per env in the ram_obs and frame_obs arrays of Zelda3Batch_Step.
+ZELDA3_API size_t Zelda3Batch_GetRamObsSize(Zelda3Batch *b);
+ZELDA3_API size_t Zelda3Batch_GetFrameObsSize(Zelda3Batch *b, int *width, int *height);
+// Replaces the state of one env with a snapshot from Zelda3_SaveState.
+ZELDA3_API bool Zelda3Batch_SetState(Zelda3Batch *b, int env, const void *state, size_t size);
+// Only works when there are more envs than workers, otherwise the states
+// never leave the workers.
+ZELDA3_API bool Zelda3Batch_GetState(Zelda3Batch *b, int env, void *state, size_t size);
+// Runs |frames| frames on every env, holding inputs[env * 2] and
+// inputs[env * 2 + 1] as the two joypads. Only the last frame gets drawn. The
+// observations are written per env into the arrays, any of which may be NULL.
+ZELDA3_API void Zelda3Batch_Step(Zelda3Batch *b, const uint16_t *inputs, int frames,
+                                 uint8_t *ram_obs, uint8_t *frame_obs, Zelda3EnvInfo *info);
+
+// Rollout server. The process that booted the game serves rollouts on a Unix
+// socket and forks a worker for each connection, which shares the booted
+// game copy-on-write. A rollout is a request followed by num_frames pairs
+// of joypad inputs. It answers with a result followed by the RAM ranges and
+// then the frame.
+enum {
+  kZelda3_RolloutMaxFrames = 1 << 20,
+  kZelda3_RolloutMaxRamRanges = 8,
+  // The RAM ranges and the frame together can't be larger than this, so at
+  // most all of the RAM and a full frame.
+  kZelda3_RolloutMaxObsSize = kZelda3_RamSize + kZelda3_ScreenWidth * kZelda3_ScreenHeight * 3,
+
+  // Start from where the previous rollout on the connection ended, rather
+  // than from the state the server started in.
+  kZelda3_Rollout_Continue = 1,
+  // Fill in private_kb, which costs a read of /proc.
+  kZelda3_Rollout_ReportMemory = 2,
+};
+
+typedef struct Zelda3RolloutRequest {
+  uint32_t num_frames;
+  uint32_t flags;
+  uint32_t num_ram_ranges;
+  Zelda3RamRange ram_ranges[kZelda3_RolloutMaxRamRanges];
+  // Frame as drawn by Zelda3_DrawObservation after the last frame. A width
+  // of 0 disables it.
+  uint16_t frame_width, frame_height;
+  uint32_t frame_channels;
+} Zelda3RolloutRequest;
+
+typedef struct Zelda3RolloutResult {
+  uint32_t ok;
+  uint32_t ram_size, frame_size;
+  // Memory the worker no longer shares with the server.
+  uint32_t private_kb;
+  uint64_t state_hash;  // as Zelda3_GetStateHash
+} Zelda3RolloutResult;
+
+// Takes the current state as the start of every rollout and serves forever.
+// Only returns on errors.
+ZELDA3_API bool Zelda3_ServeRollouts(const char *socket_path);
+// Client side, these don't need Zelda3_Init. Returns a socket or -1.
+ZELDA3_API int Zelda3Rollout_Connect(const char *socket_path);
+// Either observation buffer may be NULL to drop that part.
+ZELDA3_API bool Zelda3Rollout_Run(int fd, const Zelda3RolloutRequest *req, const uint16_t *inputs,
+                                  Zelda3RolloutResult *result, uint8_t *ram_obs, uint8_t *frame_obs);
+
+// Remote control protocol. Every request is a header followed by |size|
+// bytes of payload, and gets a response with a header of its own. Numbers
+// are little endian. Clients may send many requests before reading the
+// responses, which come back in order.
+//   Step       arg = frames per input pair, at least 1, payload = pairs of
+//              uint16 inputs.
+//              Responds with the state hash if kZelda3_RemoteStep_Hash.
+//   ReadRam    payload = uint32 addr, uint32 size. Responds with the bytes.
+//   WriteRam   payload = uint32 addr, then the bytes.
+//   GetFrame   payload = uint16 width, uint16 height, uint8 channels and 3
+//              bytes of padding. Responds with an observation, or with the
+//              full XRGB frame when the width is 0.
+//   SaveState  Responds with the snapshot.
+//   LoadState  payload = a snapshot.
+//   Info       Responds with uint32 version, state size, RAM size and 0.
+// RAM addresses are the same as in src/variables.h.
+enum {
+  kZelda3_RemoteVersion = 1,
+  kZelda3_RemoteMaxPayload = 16 << 20,
+
+  kZelda3_Remote_Step = 1,
+  kZelda3_Remote_ReadRam = 2,
+  kZelda3_Remote_WriteRam = 3,
+  kZelda3_Remote_GetFrame = 4,
+  kZelda3_Remote_SaveState = 5,
+  kZelda3_Remote_LoadState = 6,
+  kZelda3_Remote_Info = 7,
+
+  kZelda3_RemoteStep_Hash = 1,
+
+  kZelda3_RemoteStatus_Ok = 0,
+  kZelda3_RemoteStatus_BadRequest = 1,
+};
+
+typedef struct Zelda3RemoteHeader {
+  uint8_t cmd;
+  uint8_t flags;  // status in responses
+  uint16_t arg;
+  uint32_t size;
+} Zelda3RemoteHeader;
+
+// Serves clients one at a time on tcp:PORT (127.0.0.1 only) or unix:PATH,
+// all controlling this game. Only returns on errors.
+ZELDA3_API bool Zelda3_ServeRemote(const char *address);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ZELDA3_LIBZELDA3_H_
@@ -0,0 +1,209 @@
+// Remote control of the game over a Unix socket or loopback TCP, for bots
+// and tools in other languages. See kZelda3_Remote_* in libzelda3.h for the
+// protocol. Requests are handled in order, and all the responses to the
+// requests that arrived together go out in one write, so clients can keep
+// many requests in flight.
+#include "libzelda3.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "src/types.h"
+
+typedef struct RemoteBuf {
+  uint8 *data;
+  size_t size, capacity;
+} RemoteBuf;
+
+static uint8 *RemoteBuf_Reserve(RemoteBuf *b, size_t n) {
+  if (b->size + n > b->capacity) {
+    b->capacity = (b->size + n) * 2;
+    b->data = realloc(b->data, b->capacity);
+    if (!b->data)
+      Die("Out of memory");
+  }
+  return b->data + b->size;
+}
+
+// Appends a response header and returns where its payload goes.
+static uint8 *Remote_AddResponse(RemoteBuf *out, uint8 cmd, uint8 status, uint32 size) {
+  uint8 *p = RemoteBuf_Reserve(out, sizeof(Zelda3RemoteHeader) + size);
+  Zelda3RemoteHeader hdr = { cmd, status, 0, size };
+  memcpy(p, &hdr, sizeof(hdr));
+  out->size += sizeof(hdr) + size;
+  return p + sizeof(hdr);
+}
+
+static uint32 ReadU32(const uint8 *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32)p[3] << 24;
+}
+
+static void Remote_Handle(const Zelda3RemoteHeader *hdr, const uint8 *payload, RemoteBuf *out) {
+  uint32 size = hdr->size;
+  switch (hdr->cmd) {
+  case kZelda3_Remote_Step: {
+    // Each input pair runs for |arg| frames, only the last one is drawn.
+    if (size % 4 != 0 || hdr->arg == 0)
+      break;
+    for (uint32 i = 0; i < size; i += 4)
+      Zelda3_RunFrames(payload[i] | payload[i + 1] << 8, payload[i + 2] | payload[i + 3] << 8,
+                       hdr->arg, 0, NULL);
+    if (hdr->flags & kZelda3_RemoteStep_Hash) {
+      uint64 hash = Zelda3_GetStateHash();
+      memcpy(Remote_AddResponse(out, hdr->cmd, 0, 8), &hash, 8);
+    } else {
+      Remote_AddResponse(out, hdr->cmd, 0, 0);
+    }
+    return;
+  }
+  case kZelda3_Remote_ReadRam: {
+    if (size != 8)
+      break;
+    uint32 addr = ReadU32(payload), n = ReadU32(payload + 4);
+    if (addr > kZelda3_RamSize || n > kZelda3_RamSize - addr)
+      break;
+    Zelda3_ReadRam(addr, Remote_AddResponse(out, hdr->cmd, 0, n), n);
+    return;
+  }
+  case kZelda3_Remote_WriteRam:
+    if (size < 4 || !Zelda3_WriteRam(ReadU32(payload), payload + 4, size - 4))
+      break;
+    Remote_AddResponse(out, hdr->cmd, 0, 0);
+    return;
+  case kZelda3_Remote_GetFrame: {
+    // A width of 0 asks for the full XRGB frame.
+    if (size != 8)
+      break;
+    int w = payload[0] | payload[1] << 8, h = payload[2] | payload[3] << 8, c = payload[4];
+    if (w == 0) {
+      uint32 n = kZelda3_ScreenWidth * kZelda3_ScreenHeight * 4;
+      Zelda3_DrawFrame(Remote_AddResponse(out, hdr->cmd, 0, n), kZelda3_ScreenWidth * 4);
+      return;
+    }
+    if (w > kZelda3_ScreenWidth || h <= 0 || h > kZelda3_ScreenHeight || !(c == 1 || c == 3))
+      break;
+    Zelda3_DrawObservation(Remote_AddResponse(out, hdr->cmd, 0, w * h * c), w, h, c);
+    return;
+  }
+  case kZelda3_Remote_SaveState: {
+    uint32 n = Zelda3_GetStateSize();
+    Zelda3_SaveState(Remote_AddResponse(out, hdr->cmd, 0, n));
+    return;
+  }
+  case kZelda3_Remote_LoadState:
+    if (!Zelda3_LoadState(payload, size))
+      break;
+    Remote_AddResponse(out, hdr->cmd, 0, 0);
+    return;
+  case kZelda3_Remote_Info: {
+    uint32 info[4] = { kZelda3_RemoteVersion, Zelda3_GetStateSize(), kZelda3_RamSize, 0 };
+    memcpy(Remote_AddResponse(out, hdr->cmd, 0, sizeof(info)), info, sizeof(info));
+    return;
+  }
+  }
+  Remote_AddResponse(out, hdr->cmd, kZelda3_RemoteStatus_BadRequest, 0);
+}
+
+static bool WriteAll(int fd, const uint8 *p, size_t size) {
+  while (size) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n, size -= n;
+  }
+  return true;
+}
+
+static void Remote_ServeClient(int fd, RemoteBuf *in, RemoteBuf *out) {
+  in->size = 0;
+  for (;;) {
+    ssize_t n = read(fd, RemoteBuf_Reserve(in, 65536), 65536);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    in->size += n;
+    // Handle every complete request, then send all the responses at once.
+    size_t pos = 0;
+    out->size = 0;
+    while (in->size - pos >= sizeof(Zelda3RemoteHeader)) {
+      Zelda3RemoteHeader hdr;
+      memcpy(&hdr, in->data + pos, sizeof(hdr));
+      if (hdr.size > kZelda3_RemoteMaxPayload) {
+        Remote_AddResponse(out, hdr.cmd, kZelda3_RemoteStatus_BadRequest, 0);
+        WriteAll(fd, out->data, out->size);
+        return;
+      }
+      if (in->size - pos - sizeof(hdr) < hdr.size)
+        break;
+      Remote_Handle(&hdr, in->data + pos + sizeof(hdr), out);
+      pos += sizeof(hdr) + hdr.size;
+    }
+    memmove(in->data, in->data + pos, in->size - pos);
+    in->size -= pos;
+    if (out->size && !WriteAll(fd, out->data, out->size))
+      return;
+  }
+}
+
+// Addresses are tcp:PORT on 127.0.0.1, or unix:PATH.
+static int Remote_Listen(const char *address) {
+  int fd;
+  if (strncmp(address, "tcp:", 4) == 0) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(atoi(address + 4)),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int one = 1;
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+      return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      goto fail;
+  } else {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = strncmp(address, "unix:", 5) == 0 ? address + 5 : address;
+    if (strlen(path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return -1;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      goto fail;
+  }
+  if (listen(fd, 4) == 0)
+    return fd;
+fail:
+  close(fd);
+  return -1;
+}
+
+bool Zelda3_ServeRemote(const char *address) {
+  int listen_fd = Remote_Listen(address);
+  if (listen_fd < 0)
+    return false;
+  signal(SIGPIPE, SIG_IGN);
+  RemoteBuf in = { 0 }, out = { 0 };
+  // One client at a time, they all control the same game.
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Remote_ServeClient(fd, &in, &out);
+    close(fd);
+  }
+  close(listen_fd);
+  free(in.data);
+  free(out.data);
+  return false;
+}
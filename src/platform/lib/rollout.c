@@ -0,0 +1,207 @@
+// Serves rollouts over a Unix socket. The server process holds the booted
+// game and forks one worker per connection, so the assets and the start
+// state are shared copy-on-write and only the pages a rollout touches get
+// copied.
+#include "libzelda3.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "src/audio.h"
+#include "src/variables.h"
+#include "src/zelda_rtl.h"
+
+static bool ReadAll(int fd, void *data, size_t size) {
+  uint8 *p = data;
+  while (size) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n, size -= n;
+  }
+  return true;
+}
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+  const uint8 *p = data;
+  while (size) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n, size -= n;
+  }
+  return true;
+}
+
+static bool Rollout_CheckRequest(const Zelda3RolloutRequest *req, uint32 *ram_size, uint32 *frame_size) {
+  if (req->num_frames > kZelda3_RolloutMaxFrames || req->num_ram_ranges > kZelda3_RolloutMaxRamRanges)
+    return false;
+  uint32 total = 0;
+  for (uint32 i = 0; i < req->num_ram_ranges; i++) {
+    const Zelda3RamRange *r = &req->ram_ranges[i];
+    if (r->addr > kZelda3_RamSize || r->size > kZelda3_RamSize - r->addr)
+      return false;
+    total += r->size;
+  }
+  *ram_size = total;
+  *frame_size = 0;
+  if (req->frame_width) {
+    if (req->frame_width > kZelda3_ScreenWidth || req->frame_height == 0 ||
+        req->frame_height > kZelda3_ScreenHeight || !(req->frame_channels == 1 || req->frame_channels == 3))
+      return false;
+    *frame_size = req->frame_width * req->frame_height * req->frame_channels;
+  }
+  // Each range fits the RAM, but they may overlap.
+  return total <= kZelda3_RolloutMaxObsSize - *frame_size;
+}
+
+// Private memory of this process, which is what the worker copied from the
+// server so far.
+static uint32 Rollout_GetPrivateKb(void) {
+  uint32 kb = 0;
+#if defined(__linux__)
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f) {
+    char line[128];
+    unsigned v;
+    while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "Private_Clean: %u kB", &v) == 1 || sscanf(line, "Private_Dirty: %u kB", &v) == 1)
+        kb += v;
+    }
+    fclose(f);
+  }
+#endif
+  return kb;
+}
+
+static void NORETURN Rollout_WorkerMain(int fd, const uint8 *start_state, size_t state_size) {
+  uint16 *inputs = malloc(kZelda3_RolloutMaxFrames * 2 * sizeof(uint16));
+  uint8 *obs = malloc(kZelda3_RolloutMaxObsSize);
+  if (!inputs || !obs)
+    Die("Out of memory");
+  Zelda3RolloutRequest req;
+  while (ReadAll(fd, &req, sizeof(req))) {
+    Zelda3RolloutResult res = { 0 };
+    uint32 ram_size, frame_size;
+    if (!Rollout_CheckRequest(&req, &ram_size, &frame_size) ||
+        !ReadAll(fd, inputs, req.num_frames * 2 * sizeof(uint16))) {
+      // The rest of the stream can't be trusted.
+      WriteAll(fd, &res, sizeof(res));
+      break;
+    }
+    if (!(req.flags & kZelda3_Rollout_Continue))
+      ZeldaLoadState(start_state, state_size);
+    for (uint32 i = 0; i < req.num_frames; i++)
+      Zelda3_RunFrames(inputs[i * 2], inputs[i * 2 + 1], 1, 0, NULL);
+
+    uint8 *dst = obs;
+    for (uint32 i = 0; i < req.num_ram_ranges; i++) {
+      memcpy(dst, g_ram_access(req.ram_ranges[i].addr), req.ram_ranges[i].size);
+      dst += req.ram_ranges[i].size;
+    }
+    if (frame_size)
+      ZeldaDrawPpuObservation(dst, req.frame_width, req.frame_height, req.frame_channels);
+    res.ok = 1;
+    res.ram_size = ram_size;
+    res.frame_size = frame_size;
+    res.state_hash = ZeldaGetStateHash();
+    if (req.flags & kZelda3_Rollout_ReportMemory)
+      res.private_kb = Rollout_GetPrivateKb();
+    if (!WriteAll(fd, &res, sizeof(res)) || !WriteAll(fd, obs, ram_size + frame_size))
+      break;
+  }
+  _exit(0);
+}
+
+bool Zelda3_ServeRollouts(const char *socket_path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, socket_path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+    close(listen_fd);
+    return false;
+  }
+
+  // Every rollout starts from here unless it continues the previous one.
+  size_t state_size = ZeldaGetStateSize();
+  uint8 *start_state = malloc(state_size);
+  if (!start_state)
+    Die("Out of memory");
+  ZeldaSaveState(start_state);
+
+  // Workers get reaped automatically.
+  struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_NOCLDWAIT };
+  sigaction(SIGCHLD, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  ZeldaShutdownMsu();
+  fflush(stdout);
+  fflush(stderr);
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listen_fd);
+      Rollout_WorkerMain(fd, start_state, state_size);
+    }
+    close(fd);
+  }
+  close(listen_fd);
+  free(start_state);
+  return false;
+}
+
+int Zelda3Rollout_Connect(const char *socket_path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool Zelda3Rollout_Run(int fd, const Zelda3RolloutRequest *req, const uint16_t *inputs,
+                       Zelda3RolloutResult *result, uint8_t *ram_obs, uint8_t *frame_obs) {
+  if (!WriteAll(fd, req, sizeof(*req)) ||
+      !WriteAll(fd, inputs, req->num_frames * 2 * sizeof(uint16)) ||
+      !ReadAll(fd, result, sizeof(*result)) || !result->ok)
+    return false;
+  // The observations come back to back, so read them even without a buffer.
+  uint8 skip[4096];
+  for (int i = 0; i < 2; i++) {
+    uint8 *dst = i ? frame_obs : ram_obs;
+    size_t left = i ? result->frame_size : result->ram_size;
+    while (left) {
+      size_t n = dst ? left : left < sizeof(skip) ? left : sizeof(skip);
+      if (!ReadAll(fd, dst ? dst : skip, n))
+        return false;
+      if (dst)
+        dst += n;
+      left -= n;
+    }
+  }
+  return true;
+}
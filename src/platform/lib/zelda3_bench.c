@@ -0,0 +1,273 @@
+// Measures how fast a program embedding libzelda3 can step the game.
+//   zelda3_bench [assets file] [frames] [save file] [batch envs] [rollout clients]
+//                [frames per batch step] [frames per rollout]
+// Without a save file the run starts from power on, so most of it is spent
+// in the intro and the file select screen. With batch envs it also steps
+// that many envs at once with 1, 2, 4... workers up to the number of cpus,
+// 4 frames per step unless given. 0 frames per step only measures the cost
+// of the pool and the observations.
+// With rollout clients it runs a rollout server and that many clients
+// talking to it over a Unix socket, with rollouts of 60 frames unless given.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libzelda3.h"
+
+enum { kAudioFreq = 48000 };
+
+static double NowSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t Rand(uint32_t *seed) {
+  *seed = *seed * 1664525 + 1013904223;
+  return *seed >> 16;
+}
+
+// Holds each random joypad state for a few frames, like a player would.
+static uint16_t NextInput(uint32_t *seed, int frame, uint16_t input) {
+  return (frame & 7) ? input : Rand(seed) & 0xfff;
+}
+
+static void Report(const char *what, int frames, double secs) {
+  printf("%-24s %8.0f steps/s, %6.2f us/step\n", what, frames / secs, secs * 1e6 / frames);
+}
+
+// Steps |num_envs| envs for about |frames| frames in total with each worker
+// count, with the RAM of the main module and an 84x84 gray frame as the
+// observations.
+static void RunBatchBenchmark(int num_envs, int frames, int frames_per_step) {
+  static const Zelda3RamRange kRanges[] = { { 0x10, 2 }, { 0xf36c, 2 } };
+  int num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int steps = frames / (num_envs * (frames_per_step > 0 ? frames_per_step : 1));
+  if (steps < 10)
+    steps = 10;
+  uint16_t *inputs = calloc(num_envs * 2, sizeof(uint16_t));
+  Zelda3EnvInfo *info = calloc(num_envs, sizeof(Zelda3EnvInfo));
+  for (int workers = 1;; workers *= 2) {
+    workers = workers < num_cpus ? workers : num_cpus;
+    Zelda3BatchConfig config = {
+      .num_envs = num_envs, .num_workers = workers, .pin_workers = true,
+      .ram_ranges = kRanges, .num_ram_ranges = 2,
+      .frame_width = 84, .frame_height = 84, .frame_channels = 1,
+    };
+    Zelda3Batch *b = Zelda3Batch_Create(&config);
+    if (!b) {
+      fprintf(stderr, "Unable to create batch\n");
+      break;
+    }
+    uint8_t *ram_obs = malloc(num_envs * Zelda3Batch_GetRamObsSize(b));
+    uint8_t *frame_obs = malloc(num_envs * Zelda3Batch_GetFrameObsSize(b, NULL, NULL));
+    uint32_t seed = 1;
+    double t = NowSeconds();
+    for (int i = 0; i < steps; i++) {
+      for (int e = 0; e < num_envs; e++)
+        inputs[e * 2] = Rand(&seed) & 0xfff;
+      Zelda3Batch_Step(b, inputs, frames_per_step, ram_obs, frame_obs, info);
+    }
+    double secs = NowSeconds() - t;
+    printf("batch %3d envs %3d workers %d frames per step %8.0f env-steps/s, %8.0f frames/s%s\n",
+           num_envs, Zelda3Batch_GetNumWorkers(b), frames_per_step, steps * num_envs / secs,
+           steps * num_envs * frames_per_step / secs, frames_per_step ? "" : " (pool and observations only)");
+    free(ram_obs);
+    free(frame_obs);
+    Zelda3Batch_Destroy(b);
+    if (workers >= num_cpus || workers >= num_envs)
+      break;
+  }
+  free(inputs);
+  free(info);
+}
+
+// Each client does |rollouts| rollouts of |frames| frames from the start
+// state, and reports the private memory of its worker after the first and
+// the last one through |pipe_fd|.
+static void RunRolloutClient(const char *path, int rollouts, int frames, int pipe_fd, uint32_t seed) {
+  int fd = -1;
+  for (int tries = 0; fd < 0 && tries < 500; tries++) {
+    if ((fd = Zelda3Rollout_Connect(path)) < 0)
+      usleep(10000);
+  }
+  uint16_t *inputs = calloc(frames * 2 + 2, sizeof(uint16_t));
+  Zelda3RolloutRequest req = {
+    .num_frames = frames, .num_ram_ranges = 1, .ram_ranges = { { 0xdd0, 16 } },
+    .frame_width = 84, .frame_height = 84, .frame_channels = 1,
+  };
+  uint8_t ram[16], frame[84 * 84];
+  uint32_t kb[2] = { 0, 0 };
+  for (int i = 0; i < rollouts && fd >= 0; i++) {
+    uint16_t input = 0;
+    for (int j = 0; j < frames; j++)
+      inputs[j * 2] = input = NextInput(&seed, j, input);
+    req.flags = (i == 0 || i == rollouts - 1) ? kZelda3_Rollout_ReportMemory : 0;
+    Zelda3RolloutResult res;
+    if (!Zelda3Rollout_Run(fd, &req, inputs, &res, ram, frame))
+      break;
+    if (i == 0)
+      kb[0] = res.private_kb;
+    kb[1] = res.private_kb;
+  }
+  write(pipe_fd, kb, sizeof(kb));
+  _exit(0);
+}
+
+static void RunRolloutBenchmark(int clients, int rollouts, int frames) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/zelda3_bench_%d.sock", (int)getpid());
+  pid_t server = fork();
+  if (server == 0) {
+    Zelda3_ServeRollouts(path);
+    _exit(1);
+  }
+  int fds[2];
+  if (pipe(fds) < 0)
+    return;
+  double t = NowSeconds();
+  for (int i = 0; i < clients; i++) {
+    if (fork() == 0)
+      RunRolloutClient(path, rollouts, frames, fds[1], i + 1);
+  }
+  uint32_t kb[2], first = 0, last = 0;
+  for (int i = 0; i < clients; i++) {
+    read(fds[0], kb, sizeof(kb));
+    first += kb[0], last += kb[1];
+  }
+  double secs = NowSeconds() - t;
+  kill(server, SIGTERM);
+  while (wait(NULL) > 0) {
+  }
+  unlink(path);
+  close(fds[0]);
+  close(fds[1]);
+  printf("rollouts %3d clients %d frames %8.1f rollouts/s, worker private memory %u KB after one, %u KB after %d%s\n",
+         clients, frames, clients * rollouts / secs, first / clients, last / clients, rollouts,
+         frames ? "" : " (protocol and state load only)");
+}
+
+int main(int argc, char **argv) {
+  const char *assets = argc > 1 ? argv[1] : NULL;
+  int frames = argc > 2 ? atoi(argv[2]) : 20000;
+  const char *save = argc > 3 && argv[3][0] ? argv[3] : NULL;
+  int batch_envs = argc > 4 ? atoi(argv[4]) : 0;
+  int rollout_clients = argc > 5 ? atoi(argv[5]) : 0;
+  int batch_frames_per_step = argc > 6 ? atoi(argv[6]) : 4;
+  int rollout_frames = argc > 7 ? atoi(argv[7]) : 60;
+  if (frames <= 0)
+    frames = 20000;
+
+  double t0 = NowSeconds();
+  Zelda3_Init(assets, kAudioFreq);
+  printf("Init: %.1f ms\n", (NowSeconds() - t0) * 1000);
+  if (save && !Zelda3_LoadSaveFile(save)) {
+    fprintf(stderr, "Unable to load %s\n", save);
+    return 1;
+  }
+
+  size_t state_size = Zelda3_GetStateSize();
+  uint8_t *start = malloc(state_size), *state = malloc(state_size);
+  uint8_t *pixels = malloc(kZelda3_ScreenWidth * kZelda3_ScreenHeight * 4);
+  int audio_samples = 534 * kAudioFreq / 32000;
+  int16_t *audio = malloc(audio_samples * 2 * sizeof(int16_t));
+  if (!start || !state || !pixels || !audio)
+    return 1;
+  Zelda3_SaveState(start);
+
+  // Each pass starts from the same state with the same inputs.
+  for (int pass = 0; pass < 3; pass++) {
+    Zelda3_LoadState(start, state_size);
+    uint32_t seed = 1;
+    uint16_t input = 0;
+    uint32_t checksum = 0;
+    double t = NowSeconds();
+    for (int i = 0; i < frames; i++) {
+      input = NextInput(&seed, i, input);
+      Zelda3_RunFrame(input, 0);
+      if (pass >= 1)
+        Zelda3_DrawFrame(pixels, kZelda3_ScreenWidth * 4);
+      if (pass >= 2)
+        Zelda3_RenderAudio(audio, audio_samples, 2);
+      checksum = checksum * 31 + Zelda3_GetRam()[0x10];
+    }
+    static const char *const kPassNames[3] = { "run", "run + draw", "run + draw + audio" };
+    Report(kPassNames[pass], frames, NowSeconds() - t);
+    printf("  ram checksum %08x\n", checksum);
+  }
+
+  // Repeating each input for 4 frames, drawing and playing only the last
+  // of them versus all of them. The hashes must not differ.
+  double repeat_secs[2];
+  uint64_t repeat_hash[2];
+  for (int pass = 0; pass < 2; pass++) {
+    Zelda3_LoadState(start, state_size);
+    uint32_t seed = 1;
+    Zelda3FrameOutput out = { pixels, kZelda3_ScreenWidth * 4, audio, 2 };
+    double t = NowSeconds();
+    for (int i = 0; i < frames; i += 4)
+      Zelda3_RunFrames(NextInput(&seed, 0, 0), 0, 4, pass ? 0 : kZelda3_RunFrames_NoElision, &out);
+    repeat_secs[pass] = NowSeconds() - t;
+    repeat_hash[pass] = Zelda3_GetStateHash();
+    Report(pass ? "repeat 4, elided" : "repeat 4, every frame", frames, repeat_secs[pass]);
+    printf("  state hash %016llx\n", (unsigned long long)repeat_hash[pass]);
+  }
+  printf("Elision: %.2fx the frames/s%s\n", repeat_secs[0] / repeat_secs[1],
+         repeat_hash[0] == repeat_hash[1] ? "" : ", STATE HASH MISMATCH");
+
+  int rounds = 1000;
+  double t = NowSeconds();
+  for (int i = 0; i < rounds; i++)
+    Zelda3_SaveState(state);
+  double save_us = (NowSeconds() - t) * 1e6 / rounds;
+  t = NowSeconds();
+  for (int i = 0; i < rounds; i++)
+    Zelda3_LoadState(state, state_size);
+  double load_us = (NowSeconds() - t) * 1e6 / rounds;
+  printf("State: %zu bytes, save %.1f us, load %.1f us\n", state_size, save_us, load_us);
+
+  // Drawing cost of the observations compared to a full frame, on the state
+  // where the run ended.
+  static const struct { int w, h, c; } kObs[] = { { 84, 84, 1 }, { 128, 112, 3 } };
+  t = NowSeconds();
+  for (int i = 0; i < rounds; i++)
+    Zelda3_DrawFrame(pixels, kZelda3_ScreenWidth * 4);
+  double full_us = (NowSeconds() - t) * 1e6 / rounds;
+  printf("Draw: full %.1f us", full_us);
+  for (int j = 0; j < 2; j++) {
+    t = NowSeconds();
+    for (int i = 0; i < rounds; i++)
+      Zelda3_DrawObservation(pixels, kObs[j].w, kObs[j].h, kObs[j].c);
+    double us = (NowSeconds() - t) * 1e6 / rounds;
+    printf(", %dx%dx%d %.1f us (%.0f%%)", kObs[j].w, kObs[j].h, kObs[j].c, us, us * 100 / full_us);
+  }
+  static const Zelda3Feature kFeatures[] = {
+    { 0xd10, 16 }, { 0xdd0, 16 }, { 0x20, 2, kZelda3_Feature_U16 }, { 0x5d, 1 },
+  };
+  float features[64];
+  t = NowSeconds();
+  for (int i = 0; i < rounds; i++)
+    Zelda3_ReadFeatures(kFeatures, 4, features);
+  printf(", %zu features %.2f us\n", Zelda3_GetFeatureCount(kFeatures, 4),
+         (NowSeconds() - t) * 1e6 / rounds);
+
+  if (batch_envs > 0) {
+    Zelda3_LoadState(start, state_size);
+    RunBatchBenchmark(batch_envs, frames, batch_frames_per_step);
+  }
+
+  if (rollout_clients > 0) {
+    Zelda3_LoadState(start, state_size);
+    RunRolloutBenchmark(rollout_clients, frames / (rollout_frames > 0 ? rollout_frames : 1) / rollout_clients + 1,
+                        rollout_frames);
+  }
+
+  free(start);
+  free(state);
+  free(pixels);
+  free(audio);
+  return 0;
+}
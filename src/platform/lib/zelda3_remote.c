@@ -0,0 +1,22 @@
+// Runs the game headless under remote control, see Zelda3_ServeRemote.
+//   zelda3_remote [address] [assets file] [save file]
+// The address defaults to unix:zelda3.sock, other/remote_loadtest.py is a
+// client for it.
+#include <stdio.h>
+#include "libzelda3.h"
+
+int main(int argc, char **argv) {
+  const char *address = argc > 1 ? argv[1] : "unix:zelda3.sock";
+  const char *assets = argc > 2 ? argv[2] : NULL;
+  const char *save = argc > 3 ? argv[3] : NULL;
+  Zelda3_Init(assets, 48000);
+  if (save && !Zelda3_LoadSaveFile(save)) {
+    fprintf(stderr, "Unable to load %s\n", save);
+    return 1;
+  }
+  printf("Serving on %s\n", address);
+  fflush(stdout);
+  Zelda3_ServeRemote(address);
+  fprintf(stderr, "Unable to serve on %s\n", address);
+  return 1;
+}
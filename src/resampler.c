@@ -0,0 +1,227 @@
+#include "resampler.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The sinc filters are windowed with a kaiser window and stored as
+// kResamplerPhases sets of Q14 coefficients. Within each group of 4 taps the
+// coefficients are stored as c0 c1 c0 c1 c2 c3 c2 c3 so that a single
+// _mm_madd_epi16 on interleaved stereo frames (after a shuffle to
+// L0 L1 R0 R1 L2 L3 R2 R3) computes both channels at once.
+enum {
+  kResamplerPhaseBits = 9,
+  kResamplerCoefBits = 14,
+};
+
+static const uint8 kResamplerTaps[kResampler_NumQualities] = { 2, 2, 8, 16 };
+// Passband as a fraction of the lower of the two nyquist frequencies.
+// Fewer taps need a wider transition band.
+static const float kResamplerCutoff[kResampler_NumQualities] = { 0, 0, 0.80f, 0.90f };
+static const float kResamplerBeta[kResampler_NumQualities] = { 0, 0, 5.0f, 7.0f };
+
+static const double kPi = 3.14159265358979323846;
+
+static double BesselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x * 0.5 / k) * (x * 0.5 / k);
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+static int16 *Resampler_CreateTable(int quality, uint32 in_rate, uint32 out_rate) {
+  int taps = kResamplerTaps[quality];
+  int16 *table = malloc(sizeof(int16) * kResamplerPhases * taps * 2);
+  if (!table)
+    Die("Out of memory");
+  double fc = kResamplerCutoff[quality] * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+  double beta = kResamplerBeta[quality], i0_beta = BesselI0(beta);
+  for (int phase = 0; phase < kResamplerPhases; phase++) {
+    double frac = (double)phase / kResamplerPhases, h[kResamplerMaxTaps], sum = 0;
+    for (int t = 0; t < taps; t++) {
+      double x = t - (taps / 2 - 1) - frac, u = x / (taps / 2);
+      double sinc = (x == 0) ? 1.0 : sin(kPi * fc * x) / (kPi * fc * x);
+      double w = (u * u < 1.0) ? BesselI0(beta * sqrt(1.0 - u * u)) / i0_beta : 0.0;
+      h[t] = fc * sinc * w;
+      sum += h[t];
+    }
+    // Normalize for unity gain and put the rounding error on the biggest tap.
+    int c[kResamplerMaxTaps], isum = 0, biggest = 0;
+    for (int t = 0; t < taps; t++) {
+      c[t] = (int)lround(h[t] / sum * (1 << kResamplerCoefBits));
+      isum += c[t];
+      if (abs(c[t]) > abs(c[biggest]))
+        biggest = t;
+    }
+    c[biggest] += (1 << kResamplerCoefBits) - isum;
+    int16 *dst = table + phase * taps * 2;
+    for (int t = 0; t < taps; t += 4) {
+      int16 *d = dst + t * 2;
+      d[0] = d[2] = c[t + 0];
+      d[1] = d[3] = c[t + 1];
+      d[4] = d[6] = c[t + 2];
+      d[5] = d[7] = c[t + 3];
+    }
+  }
+  return table;
+}
+
+void Resampler_Init(Resampler *r, int quality, uint32 in_rate, uint32 out_rate) {
+  quality = (quality >= 0 && quality < kResampler_NumQualities) ? quality : kResampler_Nearest;
+  if (r->quality != quality || r->in_rate != in_rate || r->out_rate != out_rate || r->taps == 0) {
+    free(r->table);
+    r->table = NULL;
+    r->quality = quality;
+    r->taps = kResamplerTaps[quality];
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    if (quality >= kResampler_Sinc8)
+      r->table = Resampler_CreateTable(quality, in_rate, out_rate);
+  }
+  r->step = ((uint64)in_rate << 32) / out_rate;
+  Resampler_Reset(r);
+}
+
+void Resampler_Destroy(Resampler *r) {
+  free(r->table);
+  memset(r, 0, sizeof(*r));
+}
+
+void Resampler_Reset(Resampler *r) {
+  // Start out with silence as history and half a filter of delay.
+  r->count = r->taps - 1;
+  r->pos = (uint64)(r->taps / 2 - 1) << 32;
+  memset(r->buf, 0, sizeof(int16) * 2 * r->count);
+}
+
+uint32 Resampler_InputWanted(Resampler *r, uint32 out_count) {
+  if (out_count == 0)
+    return 0;
+  uint64 need = ((r->pos + (out_count - 1) * r->step) >> 32) + r->taps / 2 + 1;
+  return need > r->count ? (uint32)(need - r->count) : 0;
+}
+
+uint32 Resampler_Push(Resampler *r, const int16 *in, uint32 in_count) {
+  uint32 n = UintMin(in_count, countof(r->buf) / 2 - r->count);
+  memcpy(r->buf + r->count * 2, in, n * sizeof(int16) * 2);
+  r->count += n;
+  return n;
+}
+
+static void Resampler_PullNearest(Resampler *r, int16 *out, uint32 n) {
+  uint64 pos = r->pos, step = r->step;
+  for (uint32 i = 0; i < n; i++, pos += step) {
+    const int16 *s = r->buf + (pos >> 32) * 2;
+    out[i * 2 + 0] = s[0];
+    out[i * 2 + 1] = s[1];
+  }
+  r->pos = pos;
+}
+
+static void Resampler_PullLinear(Resampler *r, int16 *out, uint32 n) {
+  uint64 pos = r->pos, step = r->step;
+  for (uint32 i = 0; i < n; i++, pos += step) {
+    const int16 *s = r->buf + (pos >> 32) * 2;
+    int f = (uint32)pos >> 17;
+    out[i * 2 + 0] = (s[0] * (32768 - f) + s[2] * f) >> 15;
+    out[i * 2 + 1] = (s[1] * (32768 - f) + s[3] * f) >> 15;
+  }
+  r->pos = pos;
+}
+
+static void Resampler_PullSinc(Resampler *r, int16 *out, uint32 n) {
+  uint64 pos = r->pos, step = r->step;
+  int taps = r->taps;
+  for (uint32 i = 0; i < n; i++, pos += step) {
+    const int16 *s = r->buf + ((pos >> 32) - (taps / 2 - 1)) * 2;
+    const int16 *c = r->table + ((uint32)pos >> (32 - kResamplerPhaseBits)) * taps * 2;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (int t = 0; t < taps; t += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(s + t * 2));
+      x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+      x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i *)(c + t * 2))));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 << (kResamplerCoefBits - 1))), kResamplerCoefBits);
+    uint32 v = _mm_cvtsi128_si32(_mm_packs_epi32(acc, acc));
+    memcpy(out + i * 2, &v, 4);
+#else
+    int32 l = 0, rr = 0;
+    for (int t = 0; t < taps; t++) {
+      int coef = c[(t >> 2) * 8 + (t & 2) * 2 + (t & 1)];
+      l += s[t * 2 + 0] * coef;
+      rr += s[t * 2 + 1] * coef;
+    }
+    l = (l + (1 << (kResamplerCoefBits - 1))) >> kResamplerCoefBits;
+    rr = (rr + (1 << (kResamplerCoefBits - 1))) >> kResamplerCoefBits;
+    out[i * 2 + 0] = l < -32768 ? -32768 : l > 32767 ? 32767 : l;
+    out[i * 2 + 1] = rr < -32768 ? -32768 : rr > 32767 ? 32767 : rr;
+#endif
+  }
+  r->pos = pos;
+}
+
+uint32 Resampler_Pull(Resampler *r, int16 *out, uint32 out_count) {
+  // Produce as many frames as the queued input covers.
+  uint32 half = r->taps / 2, n = 0;
+  if (r->count > half && (r->pos >> 32) < r->count - half) {
+    uint64 end = (uint64)(r->count - half) << 32;  // first position that lacks input
+    uint64 avail = (end - r->pos + r->step - 1) / r->step;
+    n = avail < out_count ? (uint32)avail : out_count;
+  }
+  switch (r->quality) {
+  case kResampler_Nearest: Resampler_PullNearest(r, out, n); break;
+  case kResampler_Linear: Resampler_PullLinear(r, out, n); break;
+  default: Resampler_PullSinc(r, out, n); break;
+  }
+  // Drop the input that's no longer needed as history. When decimating by a
+  // lot the position may run past the queued input, then the pending skip
+  // stays in |pos|.
+  uint32 drop = UintMin((uint32)(r->pos >> 32) - (half - 1), r->count);
+  if (drop != 0) {
+    r->count -= drop;
+    memmove(r->buf, r->buf + drop * 2, r->count * sizeof(int16) * 2);
+    r->pos -= (uint64)drop << 32;
+  }
+  return n;
+}
+
+static void Resampler_BeginBlock(Resampler *r, const int16 *in, uint32 in_count, uint32 out_count) {
+  // Pick the step so that exactly |in_count| frames get consumed, rounding up
+  // so the fractional position never goes backwards.
+  uint32 frac = (uint32)r->pos;
+  r->step = (((uint64)in_count << 32) - frac + out_count - 1) / out_count;
+  uint32 pushed = Resampler_Push(r, in, in_count);
+  assert(pushed == in_count);
+  (void)pushed;
+}
+
+void Resampler_ProcessBlock(Resampler *r, const int16 *in, uint32 in_count, int16 *out, uint32 out_count) {
+  Resampler_BeginBlock(r, in, in_count, out_count);
+  uint32 pulled = Resampler_Pull(r, out, out_count);
+  assert(pulled == out_count);
+  (void)pulled;
+}
+
+void Resampler_ProcessBlockMono(Resampler *r, const int16 *in, uint32 in_count, int16 *out, uint32 out_count) {
+  Resampler_BeginBlock(r, in, in_count, out_count);
+  int16 tmp[256 * 2];
+  while (out_count) {
+    uint32 n = Resampler_Pull(r, tmp, UintMin(out_count, 256));
+    assert(n != 0);
+    for (uint32 i = 0; i < n; i++)
+      out[i] = (tmp[i * 2] + tmp[i * 2 + 1]) >> 1;
+    out += n, out_count -= n;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef ZELDA3_RESAMPLER_H_
+#define ZELDA3_RESAMPLER_H_
+
+#include "types.h"
+
+// Stereo int16 sample rate converter shared by the DSP and the MSU paths.
+enum {
+  kResampler_Nearest = 0,
+  kResampler_Linear = 1,
+  kResampler_Sinc8 = 2,
+  kResampler_Sinc16 = 3,
+  kResampler_NumQualities,
+
+  kResamplerMaxTaps = 16,
+  kResamplerPhases = 512,
+  // Input frames that can be queued at once, besides the filter history.
+  kResamplerMaxInput = 1024,
+};
+
+typedef struct Resampler {
+  uint8 quality;
+  uint8 taps;
+  uint32 in_rate, out_rate;
+  // Input frames per output frame, 32.32 fixed point.
+  uint64 step;
+  // Position of the next output frame in |buf|, 32.32 fixed point.
+  uint64 pos;
+  uint32 count;
+  int16 *table;
+  int16 buf[(kResamplerMaxTaps + kResamplerMaxInput) * 2];
+} Resampler;
+
+void Resampler_Init(Resampler *r, int quality, uint32 in_rate, uint32 out_rate);
+void Resampler_Destroy(Resampler *r);
+void Resampler_Reset(Resampler *r);
+// Streaming use: queue input until Resampler_InputWanted returns 0, then pull.
+uint32 Resampler_InputWanted(Resampler *r, uint32 out_count);
+uint32 Resampler_Push(Resampler *r, const int16 *in, uint32 in_count);
+uint32 Resampler_Pull(Resampler *r, int16 *out, uint32 out_count);
+// Converts exactly |in_count| frames into exactly |out_count| frames, for
+// callers like the DSP that produce a fixed block and vary the output size.
+void Resampler_ProcessBlock(Resampler *r, const int16 *in, uint32 in_count, int16 *out, uint32 out_count);
+// The same, with the output mixed down to mono.
+void Resampler_ProcessBlockMono(Resampler *r, const int16 *in, uint32 in_count, int16 *out, uint32 out_count);
+
+#endif  // ZELDA3_RESAMPLER_H_
@@ -1205,6 +1205,8 @@ void SpcPlayer_CopyVariablesToRam(SpcPlayer *p) {
   }
   for (const MemMapSized *m = &kSpcPlayer_Maps[0]; m != &kSpcPlayer_Maps[countof(kSpcPlayer_Maps)]; m++)
     memcpy(&p->ram[m->org_off], (uint8 *)p + m->off, m->size);
+  // All of the variables are in the first 4 pages.
+  dsp_invalidateBrrCache(p->dsp, 0, 0x400);
 }
 
 void SpcPlayer_CopyVariablesFromRam(SpcPlayer *p) {
@@ -1237,14 +1239,32 @@ void SpcPlayer_GenerateSamples(SpcPlayer *p) {
 
     p->timer_cycles += n;
 
-    for (int i = 0; i < n; i++)
-      dsp_cycle(p->dsp);
+    dsp_cycleBlock(p->dsp, n);
 
     if (p->dsp->sampleOffset == 534)
       break;
   }
 }
 
+void SpcPlayer_RunWithoutSamples(SpcPlayer *p) {
+  assert(p->timer_cycles <= 64);
+
+  // Same timer steps as above, so the driver ends up in the same state.
+  for (int left = 534 - p->dsp->sampleOffset;;) {
+    if (p->timer_cycles >= 64) {
+      Spc_Loop_Part2(p, p->timer_cycles >> 6);
+      Spc_Loop_Part1(p);
+      p->timer_cycles &= 63;
+    }
+    int n = IntMin(left, 64 - p->timer_cycles);
+    p->timer_cycles += n;
+    left -= n;
+    if (left == 0)
+      break;
+  }
+  p->dsp->sampleOffset = 0;
+}
+
 void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data) {
   Dsp_Write(p, EVOLL, 0);
   Dsp_Write(p, EVOLR, 0);
@@ -1256,6 +1276,7 @@ void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data) {
       break;
     int target = *(uint16 *)(data + 2);
     data += 4;
+    dsp_invalidateBrrCache(p->dsp, target, numbytes);
     do {
       p->ram[target++ & 0xffff] = *data++;
     } while (--numbytes);
@@ -139,6 +139,9 @@ typedef struct SpcPlayer {
 
 SpcPlayer *SpcPlayer_Create();
 void SpcPlayer_GenerateSamples(SpcPlayer *p);
+// Runs the driver for a frame like SpcPlayer_GenerateSamples, but leaves
+// the DSP alone.
+void SpcPlayer_RunWithoutSamples(SpcPlayer *p);
 void SpcPlayer_Initialize(SpcPlayer *p);
 void SpcPlayer_Upload(SpcPlayer *p, const uint8_t *data);
 void SpcPlayer_CopyVariablesFromRam(SpcPlayer *p);
@@ -34,7 +34,7 @@ typedef unsigned int uint;
 #define NOINLINE __declspec(noinline)
 #else
 #define countof(a) (sizeof(a)/sizeof(*(a)))
-#define NORETURN
+#define NORETURN __attribute__((noreturn))
 #define FORCEINLINE inline
 #define NOINLINE
 #endif
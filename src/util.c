@@ -2,6 +2,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 char *NextDelim(char **s, int sep) {
   char *r = *s;
@@ -56,6 +66,67 @@ uint8 *ReadWholeFile(const char *name, size_t *length) {
   return buffer;
 }
 
+// Maps a file read only. Returns NULL if it doesn't exist, is empty or
+// can't be mapped.
+const uint8 *MapWholeFile(const char *name, size_t *length) {
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+  LARGE_INTEGER size;
+  const uint8 *data = NULL;
+  if (GetFileSizeEx(file, &size) && size.QuadPart != 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      data = (const uint8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+  if (data && length)
+    *length = (size_t)size.QuadPart;
+  return data;
+#else
+  int fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void *data = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size != 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      data = NULL;
+  }
+  close(fd);
+  if (data && length)
+    *length = st.st_size;
+  return (const uint8 *)data;
+#endif
+}
+
+void UnmapWholeFile(const uint8 *data, size_t length) {
+  if (data == NULL)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(data);
+#else
+  munmap((void *)data, length);
+#endif
+}
+
+size_t GetResidentMemory(void) {
+#if defined(__linux__)
+  FILE *f = fopen("/proc/self/statm", "r");
+  unsigned long size, resident;
+  bool ok = f && fscanf(f, "%lu %lu", &size, &resident) == 2;
+  if (f)
+    fclose(f);
+  return ok ? (size_t)resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
 char *NextLineStripComments(char **s) {
   char *p = *s;
   if (p == NULL)
@@ -195,6 +266,61 @@ MemBlk FindIndexInMemblk(MemBlk data, size_t i) {
 }
 
 
+size_t Lz4Decompress(const uint8 *src, size_t src_size, uint8 *dst, size_t dst_size) {
+  const uint8 *src_end = src + src_size;
+  uint8 *dst_org = dst, *dst_end = dst + dst_size;
+  while (src < src_end) {
+    uint8 token = *src++;
+    size_t len = token >> 4;
+    if (len == 15) {
+      uint8 b;
+      do {
+        if (src >= src_end)
+          return 0;
+        len += b = *src++;
+      } while (b == 255);
+    }
+    if (len > (size_t)(src_end - src) || len > (size_t)(dst_end - dst))
+      return 0;
+    memcpy(dst, src, len);
+    src += len, dst += len;
+    // The last sequence has only literals.
+    if (src == src_end)
+      break;
+    if (src_end - src < 2)
+      return 0;
+    size_t offset = src[0] | src[1] << 8;
+    src += 2;
+    if (offset == 0 || offset > (size_t)(dst - dst_org))
+      return 0;
+    len = token & 15;
+    if (len == 15) {
+      uint8 b;
+      do {
+        if (src >= src_end)
+          return 0;
+        len += b = *src++;
+      } while (b == 255);
+    }
+    len += 4;
+    if (len > (size_t)(dst_end - dst))
+      return 0;
+    // Matches may overlap their own output.
+    const uint8 *m = dst - offset;
+    for (size_t i = 0; i < len; i++)
+      dst[i] = m[i];
+    dst += len;
+  }
+  return dst - dst_org;
+}
+
+uint64 HashFnv1a(uint64 h, const void *data, size_t size) {
+  const uint8 *p = (const uint8 *)data;
+  for (size_t i = 0; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
 static uint64 BpsDecodeInt(const uint8 **src) {
   uint64 data = 0, shift = 1;
   while(true) {
@@ -24,6 +24,10 @@ void ByteArray_AppendData(ByteArray *arr, const uint8 *data, size_t data_size);
 void ByteArray_AppendByte(ByteArray *arr, uint8 v);
 
 uint8 *ReadWholeFile(const char *name, size_t *length);
+const uint8 *MapWholeFile(const char *name, size_t *length);
+void UnmapWholeFile(const uint8 *data, size_t length);
+// Resident memory of this process in bytes, or 0 if unknown.
+size_t GetResidentMemory(void);
 char *NextDelim(char **s, int sep);
 char *NextLineStripComments(char **s);
 char *NextPossiblyQuotedString(char **s);
@@ -35,6 +39,11 @@ const char *SkipPrefix(const char *big, const char *little);
 void StrSet(char **rv, const char *s);
 char *StrFmt(const char *fmt, ...);
 char *ReplaceFilenameWithNewPath(const char *old_path, const char *new_path);
+// 64-bit FNV-1a, start with FNV1A_INIT and feed the result back in to continue.
+#define FNV1A_INIT 0xcbf29ce484222325ull
+uint64 HashFnv1a(uint64 h, const void *data, size_t size);
+// Decodes an LZ4 block, returns the number of bytes written or 0 on error.
+size_t Lz4Decompress(const uint8 *src, size_t src_size, uint8 *dst, size_t dst_size);
 uint8 *ApplyBps(const uint8 *src, size_t src_size_in,
   const uint8 *bps, size_t bps_size, size_t *length_out);
 
@@ -217,10 +217,20 @@ uint16 ZeldaGetScreenX(uint16 world_x) {
   return world_x - BG2HOFS_copy2;
 }
 
-void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
+// Set by ZeldaRunFrame until the frame has gone through the PPU, and the
+// height of the last drawn frame, which the undrawn ones use too.
+static bool g_ppu_frame_pending;
+static bool g_ppu_height240;
+
+// Goes through the lines of a frame like the PPU does. The HDMA writes the PPU
+// registers and at line 128 the file select screen has its irq, which also
+// clears irq_flag, so every frame has to come through here once even when
+// nothing is drawn.
+static void ZeldaRunPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags, bool draw) {
   SimpleHdma hdma_chans[2];
 
-  PpuBeginDrawing(g_zenv.ppu, pixel_buffer, pitch, render_flags);
+  if (draw)
+    PpuBeginDrawing(g_zenv.ppu, pixel_buffer, pitch, render_flags);
 
   dma_startDma(g_zenv.dma, HDMAEN_copy, true);
 
@@ -228,7 +238,7 @@ void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
   SimpleHdma_Init(&hdma_chans[1], &g_zenv.dma->channel[7]);
 
   // Cheat: Let the PPU impl know about the hdma perspective correction so it can avoid guessing.
-  if ((render_flags & kPpuRenderFlags_4x4Mode7) && g_zenv.ppu->mode == 7) {
+  if (draw && (render_flags & kPpuRenderFlags_4x4Mode7) && g_zenv.ppu->mode == 7) {
     if (hdma_chans[0].table == kMapModeHdma0)
       PpuSetMode7PerspectiveCorrection(g_zenv.ppu, kMapMode_Zooms1[0], kMapMode_Zooms1[223]);
     else if (hdma_chans[0].table == kMapModeHdma1)
@@ -239,7 +249,13 @@ void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
       PpuSetMode7PerspectiveCorrection(g_zenv.ppu, 0, 0);
   }
 
-  ZeldaPreparePpuSideSpace(render_flags);
+  if (render_flags & kPpuRenderFlags_Observation) {
+    if (draw)
+      PpuSetExtraSideSpace(g_zenv.ppu, 0, 0, 0);
+    render_flags &= ~kPpuRenderFlags_Height240;
+  } else if (draw) {
+    ZeldaPreparePpuSideSpace(render_flags);
+  }
 
   int height = render_flags & kPpuRenderFlags_Height240 ? 240 : 224;
 
@@ -254,10 +270,27 @@ void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
         zelda_snes_dummy_write(NMITIMEN, 0x81);
       }
     }
-    ppu_runLine(g_zenv.ppu, i);
+    if (draw)
+      ppu_runLine(g_zenv.ppu, i);
     SimpleHdma_DoLine(&hdma_chans[0]);
     SimpleHdma_DoLine(&hdma_chans[1]);
   }
+  g_ppu_frame_pending = false;
+  g_ppu_height240 = (height == 240);
+}
+
+void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags) {
+  ZeldaRunPpuFrame(pixel_buffer, pitch, render_flags, true);
+}
+
+void ZeldaFinishPpuFrame() {
+  if (g_ppu_frame_pending)
+    ZeldaRunPpuFrame(NULL, 0, g_ppu_height240 ? kPpuRenderFlags_Height240 : 0, false);
+}
+
+void ZeldaDrawPpuObservation(uint8 *pixels, int width, int height, int channels) {
+  PpuSetObservationTarget(g_zenv.ppu, pixels, width, height, channels);
+  ZeldaDrawPpuFrame(NULL, 0, kPpuRenderFlags_NewRenderer | kPpuRenderFlags_Observation);
 }
 
 void HdmaSetup(uint32 addr6, uint32 addr7, uint8 transfer_unit, uint8 reg6, uint8 reg7, uint8 indirect_bank) {
@@ -434,7 +467,7 @@ void ZeldaReset(bool preserve_sram) {
   ZeldaRestoreMusicAfterLoad_Locked(true);
   ZeldaApuUnlock();
   EmuSynchronizeWholeState();
-
+  g_ppu_frame_pending = false;
 }
 
 static void LoadSnesState(SaveLoadFunc *func, void *ctx) {
@@ -446,6 +479,8 @@ static void LoadSnesState(SaveLoadFunc *func, void *ctx) {
   ZeldaRestoreMusicAfterLoad_Locked(false);
   ZeldaApuUnlock();
   EmuSynchronizeWholeState();
+  // Snapshots are taken after the PPU went through the frame.
+  g_ppu_frame_pending = false;
 }
 
 static void SaveSnesState(SaveLoadFunc *func, void *ctx) {
@@ -750,6 +785,7 @@ bool ZeldaRunFrame(int input1, int input2) {
   if ((input2 & 0xc0) == 0xc0) input2 ^= 0xc0;
 
   frame_ctr_dbg++;
+  ZeldaFinishPpuFrame();
 
   bool is_replay = state_recorder.replay_mode;
 
@@ -807,10 +843,34 @@ bool ZeldaRunFrame(int input1, int input2) {
   }
 
   ZeldaPushApuState();
+  g_ppu_frame_pending = true;
 
   return is_replay;
 }
 
+bool ZeldaRunFrames(int input1, int input2, int n, uint32 flags, const ZeldaFrameOutput *out) {
+  bool is_replay = false;
+  for (int i = 0; i < n; i++) {
+    is_replay = ZeldaRunFrame(input1, input2);
+    bool output = (i == n - 1) || (flags & kZeldaRunFrames_NoElision);
+    if (output && out->pixels)
+      ZeldaDrawPpuFrame(out->pixels, out->pitch, out->render_flags);
+    if (output && out->audio)
+      ZeldaRenderAudio(out->audio, out->audio_samples, out->audio_channels);
+    else
+      ZeldaSkipAudio(out->audio_samples, out->audio_channels);
+    if (out->hashes)
+      out->hashes[i] = ZeldaGetStateHash();
+  }
+  return is_replay;
+}
+
+uint64 ZeldaGetStateHash() {
+  ZeldaFinishPpuFrame();
+  uint64 hash = HashFnv1a(FNV1A_INIT, g_ram, 0x20000);
+  return HashFnv1a(hash, g_zenv.vram, 0x10000);
+}
+
 void ZeldaSetLanguage(const char *language) {
   static const uint8 kDefaultConf[3] = { 0, 0, 0 };
   MemBlk found = { kDefaultConf, 3 };
@@ -851,6 +911,68 @@ static const char *const kReferenceSaves[] = {
   "Chapter 13 - After Ganon's Tower.sav",
 };
 
+static void countFunc(void *ctx, void *data, size_t data_size) {
+  *(size_t *)ctx += data_size;
+}
+
+static void storeFunc(void *ctx, void *data, size_t data_size) {
+  uint8 **p = (uint8 **)ctx;
+  memcpy(*p, data, data_size);
+  *p += data_size;
+}
+
+static size_t GetSnesStateSize() {
+  static size_t size;
+  if (size == 0)
+    InternalSaveLoad(&countFunc, &size);
+  return size;
+}
+
+size_t ZeldaGetStateSize() {
+  return GetSnesStateSize() + GAME_RAM_SNAPSHOT_SIZE;
+}
+
+void ZeldaSaveState(uint8 *dst) {
+  ZeldaFinishPpuFrame();
+  uint8 *p = dst;
+  SaveSnesState(&storeFunc, &p);
+  uint8_t *g_ram_copy = g_ram_snapshot_for_savestate();
+  memcpy(p, g_ram_copy, GAME_RAM_SNAPSHOT_SIZE);
+  g_ram_snapshot_free(g_ram_copy);
+}
+
+bool ZeldaLoadState(const uint8 *src, size_t size) {
+  size_t snes_size = GetSnesStateSize();
+  if (size != snes_size + GAME_RAM_SNAPSHOT_SIZE)
+    return false;
+  LoadFuncState state = { (uint8 *)src, (uint8 *)src + snes_size };
+  LoadSnesState(&loadFunc, &state);
+  load_g_ram_snapshot_from_savestate(src + snes_size);
+  // The input log starts over from the loaded state, so that saving to a slot
+  // later still replays correctly.
+  StateRecorder *sr = &state_recorder;
+  ByteArray_Resize(&sr->base_snapshot, snes_size);
+  memcpy(sr->base_snapshot.data, src, snes_size);
+  sr->log.size = 0;
+  sr->last_inputs = 0;
+  sr->frames_since_last = sr->total_frames = 0;
+  sr->replay_mode = false;
+  sr->replay_pos = sr->replay_pos_last_complete = sr->replay_frame_counter = 0;
+  return true;
+}
+
+bool SaveLoadFile(int cmd, const char *name) {
+  FILE *f = fopen(name, cmd != kSaveLoad_Save ? "rb" : "wb");
+  if (!f)
+    return false;
+  if (cmd != kSaveLoad_Save)
+    StateRecorder_Load(&state_recorder, f, cmd == kSaveLoad_Replay);
+  else
+    StateRecorder_Save(&state_recorder, f);
+  fclose(f);
+  return true;
+}
+
 void SaveLoadSlot(int cmd, int which) {
   char name[128];
   if (which & 256) {
@@ -860,17 +982,9 @@ void SaveLoadSlot(int cmd, int which) {
   } else {
     sprintf(name, "saves/save%d.sav", which);
   }
-  FILE *f = fopen(name, cmd != kSaveLoad_Save ? "rb" : "wb");
-  if (f) {
+  if (SaveLoadFile(cmd, name)) {
     printf("*** %s slot %d\n",
       cmd == kSaveLoad_Save ? "Saving" : cmd == kSaveLoad_Load ? "Loading" : "Replaying", which);
-
-    if (cmd != kSaveLoad_Save)
-      StateRecorder_Load(&state_recorder, f, cmd == kSaveLoad_Replay);
-    else
-      StateRecorder_Save(&state_recorder, f);
-
-    fclose(f);
   }
 }
 
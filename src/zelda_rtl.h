@@ -50,13 +50,43 @@ void HdmaSetup(uint32 addr6, uint32 addr7, uint8 transfer_unit, uint8 reg6, uint
 void ZeldaInitialize();
 void ZeldaReset(bool preserve_sram);
 void ZeldaDrawPpuFrame(uint8 *pixel_buffer, size_t pitch, uint32 render_flags);
+// Runs the HDMA and the mid frame register writes of the last frame without
+// drawing it, unless it was already drawn. ZeldaRunFrame, ZeldaGetStateHash
+// and ZeldaSaveState call it, so a frame that is never drawn changes the game
+// state the same way as one that is.
+void ZeldaFinishPpuFrame();
 void ZeldaPreparePpuSideSpace(uint32 render_flags);
+// Draws only the lines needed for a small gray or RGB frame, see
+// PpuSetObservationTarget.
+void ZeldaDrawPpuObservation(uint8 *pixels, int width, int height, int channels);
 int ZeldaGetPpuRenderWidth();
 int ZeldaGetPpuExtraLeft();
 int ZeldaGetPpuExtraRight();
 uint16 ZeldaGetScreenX(uint16 world_x);
 void ZeldaRunFrameInternal(uint16 input1, uint16 input2, int run_what);
 bool ZeldaRunFrame(int input1_state, int input2_state);
+
+enum {
+  // Draw and play every frame instead of only the last one.
+  kZeldaRunFrames_NoElision = 1,
+};
+
+typedef struct ZeldaFrameOutput {
+  uint8 *pixels;  // skipped when NULL
+  size_t pitch;
+  uint32 render_flags;
+  int16 *audio;  // skipped when NULL
+  int audio_samples, audio_channels;  // also used to move MSU tracks along
+  uint64 *hashes;  // ZeldaGetStateHash after each frame, when set
+} ZeldaFrameOutput;
+
+// Runs |n| frames holding the same inputs, like a bot repeating an action.
+// Only the last frame is drawn and played. The ones before still run the
+// music driver and the HDMA and register writes of the PPU, see
+// ZeldaFinishPpuFrame, but skip drawing the lines and the DSP and MSU mixing.
+bool ZeldaRunFrames(int input1, int input2, int n, uint32 flags, const ZeldaFrameOutput *out);
+// FNV-1a of RAM and VRAM.
+uint64 ZeldaGetStateHash();
 void LoadSongBank(const uint8 *p);
 void ZeldaApuLock();
 void ZeldaApuUnlock();
@@ -78,6 +108,13 @@ extern "C" {
 #endif
 
 void SaveLoadSlot(int cmd, int which);
+bool SaveLoadFile(int cmd, const char *name);
+
+// Snapshots of the whole machine in memory. Unlike the save slots they don't
+// carry the input log.
+size_t ZeldaGetStateSize();
+void ZeldaSaveState(uint8 *dst);
+bool ZeldaLoadState(const uint8 *src, size_t size);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,72 @@
+// Checks that the caches in front of the asset decoders are invisible: the
+// same calls must leave WRAM (and VRAM) the same without the cache, from a
+// cold cache and warm. zelda3_engine_bench times the same calls.
+#include <stdio.h>
+#include "test_util.h"
+#include "src/assets.h"
+#include "src/load_gfx.h"
+#include "src/overworld.h"
+#include "src/variables.h"
+#include "src/zelda_rtl.h"
+
+// The tilesets of every sprite graphics index, paired with the main and aux
+// themes, loaded the way a room or area transition does.
+static void GfxTransition(int i) {
+  if (i == 0)
+    sprite_gfx_subset_0 = sprite_gfx_subset_1 = sprite_gfx_subset_2 = sprite_gfx_subset_3 = 0;
+  sprite_graphics_index = i;
+  main_tile_theme_index = i % 37;
+  aux_tile_theme_index = i % 82;
+  InitializeTilesets();
+  LoadTransAuxGFX();
+  ReloadPreviouslyLoadedSheets();
+}
+
+static int GfxTransition_Count() {
+  return 144;
+}
+
+const CachePasses kGfxSheetCachePasses = {
+  .num_calls = &GfxTransition_Count, .call = &GfxTransition,
+  .set_enabled = &GfxSheetCache_SetEnabled, .clear = &GfxSheetCache_Clear,
+  .hits = &g_gfx_sheet_cache_stats.hits, .misses = &g_gfx_sheet_cache_stats.misses,
+  .hash_vram = true,
+};
+
+// Every overworld screen whose map halves are in the assets, decompressed
+// and drawn the way a screen transition does.
+static void OverworldScreen(int i) {
+  overworld_screen_index = i;
+  Overworld_DecompressAndDrawAllQuadrants();
+}
+
+static int OverworldScreen_Count() {
+  int n = 0;
+  while (kOverworld_Hibytes_Comp(n + 9).ptr && kOverworld_Lobytes_Comp(n + 9).ptr)
+    n++;
+  return n;
+}
+
+const CachePasses kOverworldQuadrantCachePasses = {
+  .num_calls = &OverworldScreen_Count, .call = &OverworldScreen,
+  .set_enabled = &OverworldQuadrantCache_SetEnabled, .clear = &OverworldQuadrantCache_Clear,
+  .hits = &g_ow_quadrant_cache_stats.hits, .misses = &g_ow_quadrant_cache_stats.misses,
+};
+
+static void CacheTest_Check(const char *name, const CachePasses *c) {
+  CachePassResult res[kCachePass_Count];
+  Test_RunCachePasses(c, 2, res);
+  TEST_CHECK(res[kCachePass_Cold].hash == res[kCachePass_Uncached].hash, "%s: cold cache changes the result", name);
+  TEST_CHECK(res[kCachePass_Warm].hash == res[kCachePass_Uncached].hash, "%s: warm cache changes the result", name);
+  TEST_CHECK(res[kCachePass_Warm].misses == 0, "%s: %u misses when warm", name, res[kCachePass_Warm].misses);
+}
+
+void Test_GfxSheetCache() {
+  if (Test_InitGame())
+    CacheTest_Check("gfx sheet cache", &kGfxSheetCachePasses);
+}
+
+void Test_OverworldQuadrantCache() {
+  if (Test_InitGame())
+    CacheTest_Check("overworld quadrant cache", &kOverworldQuadrantCachePasses);
+}
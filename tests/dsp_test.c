@@ -0,0 +1,182 @@
+// Renders synthetic scenes straight on the DSP, from random BRR samples and
+// scripted register writes, and compares them with the hashes that the
+// per-sample DSP produced before dsp_cycleBlock and the BRR cache existed.
+// Every scene runs once through dsp_cycle and once through dsp_cycleBlock in
+// uneven chunks, the way SpcPlayer_GenerateSamples calls it.
+#include <stdio.h>
+#include <string.h>
+#include "test_util.h"
+#include "src/util.h"
+#include "snes/dsp.h"
+
+enum {
+  kDspTest_Frames = 150,
+  kDspTest_Dir = 0x200,
+  kDspTest_Samples = 0x1000,
+  kDspTest_SampleStride = 0x300,
+  kDspTest_EchoPage = 0x60,
+};
+
+typedef enum DspTestScene {
+  kDspTest_Adsr,
+  kDspTest_Gain,
+  kDspTest_PitchModNoise,
+  kDspTest_Echo,
+  kDspTest_EchoOverlap,
+  kDspTest_RamRewrite,
+  kDspTest_NumScenes,
+} DspTestScene;
+
+static const char *const kDspTestSceneNames[kDspTest_NumScenes] = {
+  "adsr", "gain", "pitch mod noise", "echo", "echo overlap", "ram rewrite",
+};
+
+static const uint64 kDspTestExpected[kDspTest_NumScenes] = {
+  0x6c84bd285a9f5d1a, 0x723d73c3e7f59058, 0x97c18bac5e93c647,
+  0xca28fcbf61255604, 0x3f0d54ea71c0e829, 0xf66c66c08aae48c8,
+};
+
+// Sample i has 10 + 4 * i blocks with random filters and ranges, including
+// the invalid ranges 13-15. Odd samples end, even ones loop.
+static void DspTest_WriteSample(uint8 *ram, int i, uint16 addr, uint32 *seed) {
+  int blocks = 10 + 4 * i;
+  for (int b = 0; b < blocks; b++) {
+    uint8 *p = ram + addr + b * 9;
+    uint8 flags = (b == blocks - 1) ? ((i & 1) ? 1 : 3) : 0;
+    p[0] = (Test_Rand(seed) % 16) << 4 | (Test_Rand(seed) & 3) << 2 | flags;
+    for (int j = 1; j < 9; j++)
+      p[j] = Test_Rand(seed);
+  }
+  uint16 loop = addr + 9 * (i % 3);
+  WORD(ram[kDspTest_Dir + i * 4]) = addr;
+  WORD(ram[kDspTest_Dir + i * 4 + 2]) = loop;
+}
+
+static void DspTest_Setup(Dsp *dsp, uint8 *ram, DspTestScene scene, uint32 *seed) {
+  memset(ram, 0, 0x10000);
+  for (int i = 0; i < 8; i++)
+    DspTest_WriteSample(ram, i, kDspTest_Samples + i * kDspTest_SampleStride, seed);
+  // Voice 7 plays from the middle of the echo buffer, which makes the block
+  // renderer fall back to single samples.
+  if (scene == kDspTest_EchoOverlap)
+    DspTest_WriteSample(ram, 7, kDspTest_EchoPage << 8 | 0x800, seed);
+  dsp_reset(dsp);
+  dsp_write(dsp, DIR, kDspTest_Dir >> 8);
+  dsp_write(dsp, MVOLL, 0x60);
+  dsp_write(dsp, MVOLR, 0x50);
+  dsp_write(dsp, ESA, kDspTest_EchoPage);
+  for (int ch = 0; ch < 8; ch++) {
+    dsp_write(dsp, ch << 4 | V0VOLL, 0x30 + ch * 9);
+    dsp_write(dsp, ch << 4 | V0VOLR, (ch & 1) ? -0x28 : 0x40 - ch * 5);
+    dsp_write(dsp, ch << 4 | V0PITCHL, Test_Rand(seed));
+    dsp_write(dsp, ch << 4 | V0PITCHH, 0x4 + ch * 3);
+    dsp_write(dsp, ch << 4 | V0SRCN, ch);
+    dsp_write(dsp, ch << 4 | V0ADSR1, 0x80 | (ch * 0x13 & 0x7f));
+    dsp_write(dsp, ch << 4 | V0ADSR2, Test_Rand(seed));
+    dsp_write(dsp, ch << 4 | V0GAIN, 0x7f);
+  }
+  if (scene == kDspTest_Echo || scene == kDspTest_EchoOverlap) {
+    static const int8 kFir[8] = { 0x58, -0x20, 0x10, 0x08, -0x08, 0x04, 0x02, 0x7f };
+    for (int i = 0; i < 8; i++)
+      dsp_write(dsp, i << 4 | FIR0, kFir[i]);
+    dsp_write(dsp, EDL, 4);
+    dsp_write(dsp, EFB, 0x50);
+    dsp_write(dsp, EVOLL, 0x40);
+    dsp_write(dsp, EVOLR, -0x30);
+    dsp_write(dsp, EON, 0xbd);
+  }
+  // Unmuted, echo writes on unless there is no echo.
+  dsp_write(dsp, FLG, (scene == kDspTest_Echo || scene == kDspTest_EchoOverlap) ? 0x00 : 0x20);
+  dsp_write(dsp, KON, 0xff);
+}
+
+// Register writes between frames, like the sound driver does.
+static void DspTest_Step(Dsp *dsp, uint8 *ram, DspTestScene scene, int frame, uint32 *seed) {
+  int ch = frame & 7;
+  switch (frame % 12) {
+  case 3: dsp_write(dsp, KOF, 1 << ch); break;
+  case 5: dsp_write(dsp, KOF, 0); break;
+  case 6: dsp_write(dsp, ch << 4 | V0PITCHH, Test_Rand(seed) & 0x3f); break;
+  case 8: dsp_write(dsp, KON, 1 << ch | 1 << ((ch + 3) & 7)); break;
+  }
+  switch (scene) {
+  case kDspTest_Gain: {
+    // Direct, then the linear and exponential slides and the bent line.
+    static const uint8 kGains[] = { 0x40, 0x9c, 0xbf, 0xdf, 0xf4, 0x7f, 0x8a, 0xa5, 0xc3, 0xe8 };
+    dsp_write(dsp, ch << 4 | V0ADSR1, (frame & 16) ? 0x8f : 0x0f);
+    dsp_write(dsp, ch << 4 | V0GAIN, kGains[frame % countof(kGains)]);
+    break;
+  }
+  case kDspTest_PitchModNoise:
+    if (frame == 0) {
+      dsp_write(dsp, PMON, 0xfe);
+      dsp_write(dsp, NON, 0x24);
+    }
+    if (frame % 20 == 10)
+      dsp_write(dsp, FLG, 0x20 | (frame / 20 * 7 & 0x1f));
+    if (frame == 100)
+      dsp_write(dsp, NON, 0x81);
+    break;
+  case kDspTest_Echo:
+    if (frame == 60)
+      dsp_write(dsp, EDL, 2);
+    if (frame == 90)
+      dsp_write(dsp, EFB, -0x70);
+    if (frame == 120)
+      dsp_write(dsp, FLG, 0x20);
+    break;
+  case kDspTest_RamRewrite:
+    // Samples change under the decoder, as when the driver uploads a bank.
+    if (frame % 10 == 9) {
+      int i = frame / 10 & 7;
+      uint16 addr = kDspTest_Samples + i * kDspTest_SampleStride;
+      DspTest_WriteSample(ram, i, addr, seed);
+      dsp_invalidateBrrCache(dsp, addr, kDspTest_SampleStride);
+      dsp_invalidateBrrCache(dsp, kDspTest_Dir, 0x20);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static uint64 DspTest_Render(DspTestScene scene, bool blocks) {
+  uint8 *ram = calloc(1, 0x10000);
+  Dsp *dsp = dsp_init(ram);
+  uint32 seed = 1234 + scene, chunk_seed = 99;
+  DspTest_Setup(dsp, ram, scene, &seed);
+  uint64 hash = FNV1A_INIT;
+  for (int frame = 0; frame < kDspTest_Frames; frame++) {
+    DspTest_Step(dsp, ram, scene, frame, &seed);
+    dsp->sampleOffset = 0;
+    for (int left = 534; left > 0;) {
+      int n = blocks ? Test_Rand(&chunk_seed) % 80 + 1 : 1;
+      n = n < left ? n : left;
+      if (blocks)
+        dsp_cycleBlock(dsp, n);
+      else
+        dsp_cycle(dsp);
+      left -= n;
+    }
+    hash = HashFnv1a(hash, dsp->sampleBuffer, sizeof(int16) * 534 * 2);
+    for (int i = 0; i < 0x80; i++) {
+      uint8 v = dsp_read(dsp, i);
+      hash = HashFnv1a(hash, &v, 1);
+    }
+  }
+  hash = HashFnv1a(hash, ram, 0x10000);
+  dsp_free(dsp);
+  free(ram);
+  return hash;
+}
+
+void Test_Dsp() {
+  for (int scene = 0; scene < kDspTest_NumScenes; scene++) {
+    uint64 single = DspTest_Render(scene, false);
+    uint64 blocks = DspTest_Render(scene, true);
+    TEST_CHECK(single == kDspTestExpected[scene], "dsp %s: dsp_cycle gives %016llx, expected %016llx",
+               kDspTestSceneNames[scene], (unsigned long long)single, (unsigned long long)kDspTestExpected[scene]);
+    TEST_CHECK(blocks == kDspTestExpected[scene], "dsp %s: dsp_cycleBlock gives %016llx, expected %016llx",
+               kDspTestSceneNames[scene], (unsigned long long)blocks, (unsigned long long)kDspTestExpected[scene]);
+  }
+}
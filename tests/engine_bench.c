@@ -0,0 +1,308 @@
+// Benchmarks for the engine parts that have fast paths, run headless on the
+// library objects. Needs zelda3_assets.dat, or the file in $ZELDA3_ASSETS.
+//   zelda3_engine_bench assets
+//   zelda3_engine_bench lz
+//   zelda3_engine_bench dsp [frames per song] [freq]
+//   zelda3_engine_bench gfx
+//   zelda3_engine_bench overworld
+//   zelda3_engine_bench render-audio <replay> [frames] [prefix] [freq] [channels] [msu flags] [msu path]
+// make test checks that the fast paths give the same results.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_util.h"
+#include "src/assets.h"
+#include "src/asset_loader.h"
+#include "src/audio.h"
+#include "src/config.h"
+#include "src/load_gfx.h"
+#include "src/resampler.h"
+#include "src/spc_player.h"
+#include "src/util.h"
+#include "src/variables.h"
+#include "src/zelda_rtl.h"
+#include "snes/dsp.h"
+
+// Plays every song of every song bank without the game or any output and
+// prints the SPC player + DSP throughput and the share of BRR blocks that
+// came from the decode cache.
+// The indoor bank has most of the echo heavy dungeon songs.
+static void RunDspBenchmark(int frames_per_song) {
+  static const char *const kBankNames[3] = { "intro", "indoor", "ending" };
+  const uint8 *banks[3] = { kSoundBank_intro, kSoundBank_indoor, kSoundBank_ending };
+  SpcPlayer *p = SpcPlayer_Create();
+  uint64 total_samples = 0, total_ticks = 0;
+
+  for (int bank = 0; bank < 3; bank++) {
+    uint64 bank_samples = 0, bank_ticks = 0;
+    uint32 hits_before = p->dsp->brrCacheHits, misses_before = p->dsp->brrCacheMisses;
+    // The song table is at d000, the first song of intro directly follows it.
+    SpcPlayer_Initialize(p);
+    SpcPlayer_Upload(p, kSoundBank_intro);
+    int num_songs = (bank == 0) ? IntMin((WORD(p->ram[0xd000]) - 0xd000) >> 1, 35) : 35;
+    for (int song = 1; song <= num_songs; song++) {
+      SpcPlayer_Initialize(p);
+      // Like in the game, the other banks are uploaded on top of intro.
+      SpcPlayer_Upload(p, kSoundBank_intro);
+      if (bank != 0)
+        SpcPlayer_Upload(p, banks[bank]);
+      p->input_ports[0] = song;
+      uint64 before = Test_Ticks();
+      for (int i = 0; i < frames_per_song; i++) {
+        SpcPlayer_GenerateSamples(p);
+        p->dsp->sampleOffset = 0;
+      }
+      uint64 ticks = Test_Ticks() - before;
+      printf("%-6s song %2d: %6.2f Msamples/s\n", kBankNames[bank], song,
+             534.0 * frames_per_song / Test_TicksToUs(ticks));
+      bank_samples += 534 * frames_per_song;
+      bank_ticks += ticks;
+    }
+    uint32 hits = p->dsp->brrCacheHits - hits_before, misses = p->dsp->brrCacheMisses - misses_before;
+    printf("%-6s total: %.2f Msamples/s, brr cache hits %.1f%%\n", kBankNames[bank],
+           bank_samples / Test_TicksToUs(bank_ticks), hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    total_samples += bank_samples;
+    total_ticks += bank_ticks;
+  }
+  printf("Total: %.2f Msamples/s, %.1fx realtime\n", total_samples / Test_TicksToUs(total_ticks),
+         total_samples / Test_TicksToUs(total_ticks) * 1e6 / 32000);
+}
+
+// Times each ResamplerQuality on 10 seconds of the intro song, both for the
+// DSP (32000 Hz, one block per frame) and for the MSU (streamed, at whichever
+// MSU rate differs from |freq|).
+static void RunResamplerBenchmark(int freq) {
+  enum { kFrames = 600 };
+  int16 *clip = malloc(sizeof(int16) * 534 * 2 * kFrames);
+  int16 *out = malloc(sizeof(int16) * 2048 * 2);
+  if (!clip || !out)
+    Die("Out of memory");
+  SpcPlayer *p = SpcPlayer_Create();
+  SpcPlayer_Initialize(p);
+  SpcPlayer_Upload(p, kSoundBank_intro);
+  p->input_ports[0] = 1;
+  for (int i = 0; i < kFrames; i++) {
+    SpcPlayer_GenerateSamples(p);
+    memcpy(clip + i * 534 * 2, p->dsp->sampleBuffer, sizeof(p->dsp->sampleBuffer));
+    p->dsp->sampleOffset = 0;
+  }
+  int msu_freq = (freq == 48000) ? 44100 : 48000;
+  double seconds = 534.0 * kFrames / 32000;
+  for (int q = 0; q < kResampler_NumQualities; q++) {
+    Resampler r = { 0 };
+    Resampler_Init(&r, q, 32000, freq);
+    double block_size = 534.0 * freq / 32000, frac = 0;
+    uint64 before = Test_Ticks();
+    for (int i = 0; i < kFrames; i++) {
+      frac += block_size;
+      uint32 n = (uint32)frac;
+      frac -= n;
+      Resampler_ProcessBlock(&r, clip + i * 534 * 2, 534, out, n);
+    }
+    uint64 dsp_ticks = Test_Ticks() - before;
+
+    // Play the same clip as if it was an MSU track.
+    Resampler_Init(&r, q, msu_freq, freq);
+    uint32 in_pos = 0, in_total = 534 * kFrames;
+    before = Test_Ticks();
+    while (in_pos < in_total) {
+      uint32 want = Resampler_InputWanted(&r, 128);
+      in_pos += Resampler_Push(&r, clip + in_pos * 2, UintMin(want, in_total - in_pos));
+      Resampler_Pull(&r, out, 128);
+    }
+    uint64 msu_ticks = Test_Ticks() - before;
+    Resampler_Destroy(&r);
+    printf("Resampler quality %d: DSP 32000->%d %.3f ms, MSU %d->%d %.3f ms per second of audio\n",
+           q, freq, Test_TicksToUs(dsp_ticks) * 1e-3 / seconds,
+           msu_freq, freq, Test_TicksToUs(msu_ticks) * 1e-3 / (534.0 * kFrames / msu_freq));
+  }
+  free(clip);
+  free(out);
+}
+
+// Times LzDecompress on every compressed sheet and overworld map half.
+static void RunLzBenchmark() {
+  enum { kRounds = 50 };
+  static const char *const kNames[4] = { "kSprGfx", "kBgGfx", "kOverworld_Hibytes", "kOverworld_Lobytes" };
+  uint8 *dst = malloc(0x20000);
+  if (!dst)
+    Die("Out of memory");
+  for (int kind = 0; kind < 4; kind++) {
+    uint64 bytes = 0, ticks = 0;
+    int count = 0;
+    for (int i = 0;; i++) {
+      MemBlk blk = kind == 0 ? kSprGfx(i) : kind == 1 ? kBgGfx(i) :
+                   kind == 2 ? kOverworld_Hibytes_Comp(i) : kOverworld_Lobytes_Comp(i);
+      if (!blk.ptr)
+        break;
+      // Uncompressed sprite sheets are copied as is by Decomp_spr.
+      if (blk.size == 0 || (kind == 0 && (i < 12 || (i < 103 && blk.size == 0x600))))
+        continue;
+      int len = 0;
+      uint64 before = Test_Ticks();
+      for (int r = 0; r < kRounds; r++)
+        len = LzDecompress(dst, blk.ptr, kind >= 2);
+      ticks += Test_Ticks() - before;
+      bytes += (uint64)len * kRounds;
+      count++;
+    }
+    printf("%-18s: %3d streams, %7.1f MB/s\n", kNames[kind], count, bytes / Test_TicksToUs(ticks));
+  }
+  free(dst);
+}
+
+// Times |c| without its cache, from a cold cache and warm, see
+// Test_RunCachePasses.
+static void RunCacheBenchmark(const CachePasses *c, const char *per) {
+  static const char *const kPassNames[kCachePass_Count] = { "uncached", "cold", "warm" };
+  CachePassResult res[kCachePass_Count];
+  Test_RunCachePasses(c, 10, res);
+  for (int pass = 0; pass < kCachePass_Count; pass++) {
+    CachePassResult *r = &res[pass];
+    double worst = Test_TicksToUs(r->worst);
+    printf("%-8s: %7.1f us per %s, worst %7.1f us (%.3f frames), %u hits, %u misses%s\n",
+           kPassNames[pass], Test_TicksToUs(r->ticks) / (r->rounds * c->num_calls()), per, worst, worst * 60e-6,
+           r->hits, r->misses, r->hash == res[kCachePass_Uncached].hash ? "" : ", MISMATCH");
+  }
+}
+
+typedef struct WavWriter {
+  FILE *f;
+  uint32 data_size;
+} WavWriter;
+
+static void WavWriter_WriteHeader(WavWriter *w, int freq, int channels) {
+  uint8 hdr[44];
+  memcpy(hdr + 0, "RIFF", 4);
+  DWORD(hdr[4]) = 36 + w->data_size;
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  DWORD(hdr[16]) = 16;
+  WORD(hdr[20]) = 1;  // pcm
+  WORD(hdr[22]) = channels;
+  DWORD(hdr[24]) = freq;
+  DWORD(hdr[28]) = freq * channels * 2;
+  WORD(hdr[32]) = channels * 2;
+  WORD(hdr[34]) = 16;
+  memcpy(hdr + 36, "data", 4);
+  DWORD(hdr[40]) = w->data_size;
+  fseek(w->f, 0, SEEK_SET);
+  fwrite(hdr, 1, sizeof(hdr), w->f);
+}
+
+static void WavWriter_Open(WavWriter *w, const char *filename, int freq, int channels) {
+  w->f = fopen(filename, "wb");
+  if (!w->f)
+    Die("Unable to create wav file");
+  w->data_size = 0;
+  WavWriter_WriteHeader(w, freq, channels);
+}
+
+static void WavWriter_Write(WavWriter *w, const int16 *samples, size_t count) {
+  fwrite(samples, sizeof(int16), count, w->f);
+  w->data_size += count * sizeof(int16);
+}
+
+// The sizes in the header are only known at the end.
+static void WavWriter_Close(WavWriter *w, int freq, int channels) {
+  WavWriter_WriteHeader(w, freq, channels);
+  fclose(w->f);
+  w->f = NULL;
+}
+
+// Plays back a replay without video or an audio device, and writes both the
+// native 32kHz DSP output and the final mixed output at |freq| to wav files.
+// The hashes are printed every 10 seconds so two builds can be compared. MSU
+// audio is only part of the mixed output, and the mixer waits for the MSU
+// worker so that the result doesn't depend on timing.
+static int RunAudioRender(const char *replay, int max_frames, const char *out_prefix, int freq, int channels) {
+  ZeldaSetAudioOutputFreq(freq);
+  ZeldaSetMsuSynchronous(true);
+  if (!SaveLoadFile(kSaveLoad_Replay, replay)) {
+    fprintf(stderr, "Unable to open replay %s\n", replay);
+    return 1;
+  }
+  char name[256];
+  WavWriter native_wav, mixed_wav;
+  snprintf(name, sizeof(name), "%s_native.wav", out_prefix);
+  WavWriter_Open(&native_wav, name, 32000, 2);
+  snprintf(name, sizeof(name), "%s_mixed.wav", out_prefix);
+  WavWriter_Open(&mixed_wav, name, freq, channels);
+
+  int16 *buf = malloc(sizeof(int16) * 2048 * 2);
+  int16 native[534 * 2];
+  if (!buf)
+    Die("Out of memory");
+  uint64 native_hash = FNV1A_INIT, mixed_hash = FNV1A_INIT, mixed_samples = 0;
+  uint64 game_ticks = 0, audio_ticks = 0;
+  double block_size = 534.0 * freq / 32000, block_frac = 0;
+  int frame = 0;
+  while (max_frames == 0 || frame < max_frames) {
+    uint64 t0 = Test_Ticks();
+    bool is_replay = ZeldaRunFrame(0, 0);
+    if (!is_replay && max_frames == 0)
+      break;
+    uint64 t1 = Test_Ticks();
+    block_frac += block_size;
+    uint32 n = (uint32)block_frac;
+    block_frac -= n;
+    ZeldaRenderAudio(buf, n, channels);
+    memcpy(native, g_zenv.player->dsp->sampleBuffer, sizeof(native));
+    uint64 t2 = Test_Ticks();
+    game_ticks += t1 - t0;
+    audio_ticks += t2 - t1;
+
+    native_hash = HashFnv1a(native_hash, native, sizeof(native));
+    mixed_hash = HashFnv1a(mixed_hash, buf, n * channels * sizeof(int16));
+    WavWriter_Write(&native_wav, native, 534 * 2);
+    WavWriter_Write(&mixed_wav, buf, n * channels);
+    mixed_samples += n;
+    if (++frame % 600 == 0)
+      printf("frame %6d: native %016llx, mixed %016llx\n", frame,
+             (unsigned long long)native_hash, (unsigned long long)mixed_hash);
+  }
+  WavWriter_Close(&native_wav, 32000, 2);
+  WavWriter_Close(&mixed_wav, freq, channels);
+  free(buf);
+
+  double seconds = 534.0 * frame / 32000;
+  printf("Rendered %d frames (%.1f s): native %016llx, mixed %016llx\n", frame, seconds,
+         (unsigned long long)native_hash, (unsigned long long)mixed_hash);
+  printf("Game %.3f s, audio %.3f s, %.2f Msamples/s, %.1fx realtime\n",
+         Test_TicksToUs(game_ticks) * 1e-6, Test_TicksToUs(audio_ticks) * 1e-6,
+         mixed_samples / Test_TicksToUs(audio_ticks), seconds / (Test_TicksToUs(game_ticks + audio_ticks) * 1e-6));
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *mode = argc >= 2 ? argv[1] : "";
+  if (!Test_InitGame()) {
+    fprintf(stderr, "zelda3_assets.dat not found, set ZELDA3_ASSETS\n");
+    return 1;
+  }
+  if (strcmp(mode, "assets") == 0) {
+    RunAssetBenchmark();
+  } else if (strcmp(mode, "lz") == 0) {
+    RunLzBenchmark();
+  } else if (strcmp(mode, "dsp") == 0) {
+    RunDspBenchmark(argc >= 3 ? atoi(argv[2]) : 1800);
+    RunResamplerBenchmark(argc >= 4 ? atoi(argv[3]) : 48000);
+  } else if (strcmp(mode, "gfx") == 0) {
+    RunCacheBenchmark(&kGfxSheetCachePasses, "transition");
+  } else if (strcmp(mode, "overworld") == 0) {
+    RunCacheBenchmark(&kOverworldQuadrantCachePasses, "screen");
+  } else if (strcmp(mode, "render-audio") == 0 && argc >= 3) {
+    int freq = argc >= 6 ? atoi(argv[5]) : 48000, channels = argc >= 7 ? atoi(argv[6]) : 2;
+    g_config.audio_freq = freq;
+    g_config.audio_channels = channels;
+    g_config.msuvolume = 100;
+    g_config.msu_path = argc >= 9 ? argv[8] : NULL;
+    if (argc >= 8)
+      ZeldaEnableMsu(atoi(argv[7]));
+    return RunAudioRender(argv[2], argc >= 4 ? atoi(argv[3]) : 0, argc >= 5 ? argv[4] : "render", freq, channels);
+  } else {
+    fprintf(stderr, "Usage: zelda3_engine_bench assets | lz | dsp [frames per song] [freq] | gfx | overworld |\n"
+                    "  render-audio <replay> [frames] [prefix] [freq] [channels] [msu flags] [msu path]\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Checks that ZeldaRunFrames leaves the same game state whether it draws every
+// frame, only the last one of each step or none. The scenes are the ones where
+// the PPU changes the state while it draws: the HDMA of the title and the
+// attract mode, the irq of the file select screen and the ending.
+#include <stdlib.h>
+#include <string.h>
+#include "test_util.h"
+#include "src/variables.h"
+#include "src/zelda_rtl.h"
+#include "snes/ppu.h"
+
+enum {
+  kFrameTest_Steps = 600,
+  kFrameTest_FramesPerStep = 4,
+  kFrameTest_Pitch = 256 * 4,
+  kFrameTest_AudioSamples = 800,
+  kButton_Start = 1 << 3,
+};
+
+typedef struct FrameScene {
+  const char *name;
+  void (*setup)();
+} FrameScene;
+
+static void TitleScene_Setup() {
+  ZeldaReset(false);
+}
+
+// Taps start on the title until the file select screen comes up, and then
+// stays there.
+static void FileSelectScene_Setup() {
+  ZeldaReset(false);
+  for (int i = 0; i < 3000 && main_module_index != 1; i++) {
+    ZeldaRunFrame((i & 16) ? kButton_Start : 0, 0);
+    ZeldaFinishPpuFrame();
+  }
+}
+
+static void EndingScene_Setup() {
+  ZeldaReset(false);
+  main_module_index = 0x1a;
+  submodule_index = subsubmodule_index = 0;
+}
+
+static const FrameScene kFrameScenes[] = {
+  { "title", &TitleScene_Setup },
+  { "file select", &FileSelectScene_Setup },
+  { "ending", &EndingScene_Setup },
+};
+
+enum {
+  kFrameRun_DrawAll,
+  kFrameRun_DrawLast,
+  kFrameRun_DrawNone,
+  kFrameRun_Count,
+};
+
+static void FrameTest_Run(const uint8 *start, size_t start_size, int run, uint8 *pixels, int16 *audio, uint64 *hashes) {
+  ZeldaFrameOutput out = {
+    .pixels = (run != kFrameRun_DrawNone) ? pixels : NULL,
+    .pitch = kFrameTest_Pitch,
+    .render_flags = kPpuRenderFlags_NewRenderer,
+    .audio = (run != kFrameRun_DrawNone) ? audio : NULL,
+    .audio_samples = kFrameTest_AudioSamples,
+    .audio_channels = 2,
+  };
+  ZeldaLoadState(start, start_size);
+  for (int i = 0; i < kFrameTest_Steps; i++) {
+    ZeldaRunFrames(0, 0, kFrameTest_FramesPerStep,
+                   (run == kFrameRun_DrawAll) ? kZeldaRunFrames_NoElision : 0, &out);
+    hashes[i] = ZeldaGetStateHash();
+  }
+}
+
+void Test_FrameElision() {
+  if (!Test_InitGame())
+    return;
+  size_t state_size = ZeldaGetStateSize();
+  uint8 *saved = malloc(state_size), *start = malloc(state_size), *pixels = malloc(kFrameTest_Pitch * 240);
+  int16 *audio = malloc(sizeof(int16) * kFrameTest_AudioSamples * 2);
+  uint64 *hashes = malloc(sizeof(uint64) * kFrameTest_Steps * kFrameRun_Count);
+  if (!saved || !start || !pixels || !audio || !hashes)
+    Die("Out of memory");
+  ZeldaSaveState(saved);
+  for (int i = 0; i < countof(kFrameScenes); i++) {
+    const FrameScene *scene = &kFrameScenes[i];
+    scene->setup();
+    ZeldaSaveState(start);
+    for (int run = 0; run < kFrameRun_Count; run++)
+      FrameTest_Run(start, state_size, run, pixels, audio, hashes + run * kFrameTest_Steps);
+    for (int run = 1; run < kFrameRun_Count; run++) {
+      int step = 0;
+      while (step < kFrameTest_Steps && hashes[run * kFrameTest_Steps + step] == hashes[step])
+        step++;
+      TEST_CHECK(step == kFrameTest_Steps, "frames: %s differs after %d frames when drawing %s",
+                 scene->name, (step + 1) * kFrameTest_FramesPerStep, run == kFrameRun_DrawLast ? "the last frame" : "nothing");
+    }
+  }
+  ZeldaLoadState(saved, state_size);
+  free(saved), free(start), free(pixels), free(audio), free(hashes);
+}
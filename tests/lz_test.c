@@ -0,0 +1,126 @@
+// Compares LzDecompress with the original byte at a time decoder, on random
+// streams and, when the assets are there, on every compressed sheet and
+// overworld map half.
+#include <string.h>
+#include "test_util.h"
+#include "src/assets.h"
+#include "src/load_gfx.h"
+#include "src/util.h"
+
+// The original byte at a time decoder, Decompress_bank02 is the same except
+// that back reference offsets are big endian.
+static int LzDecompress_Reference(uint8 *dst, const uint8 *src, bool big_endian_offs) {
+  uint8 *dst_org = dst;
+  int len;
+  for (;;) {
+    uint8 cmd = *src++;
+    if (cmd == 0xff)
+      return dst - dst_org;
+    if ((cmd & 0xe0) != 0xe0) {
+      len = (cmd & 0x1f) + 1;
+      cmd &= 0xe0;
+    } else {
+      len = *src++;
+      len += ((cmd & 3) << 8) + 1;
+      cmd = (cmd << 3) & 0xe0;
+    }
+    if (cmd == 0) {
+      do {
+        *dst++ = *src++;
+      } while (--len);
+    } else if (cmd & 0x80) {
+      uint32 offs = big_endian_offs ? src[0] << 8 | src[1] : src[0] | src[1] << 8;
+      src += 2;
+      do {
+        *dst++ = dst_org[offs++];
+      } while (--len);
+    } else if (!(cmd & 0x40)) {
+      uint8 v = *src++;
+      do {
+        *dst++ = v;
+      } while (--len);
+    } else if (!(cmd & 0x20)) {
+      uint8 lo = *src++;
+      uint8 hi = *src++;
+      do {
+        *dst++ = lo;
+        if (--len == 0)
+          break;
+        *dst++ = hi;
+      } while (--len);
+    } else {
+      // copy bytes with the byte incrementing by 1 in between
+      uint8 v = *src++;
+      do {
+        *dst++ = v;
+      } while (v++, --len);
+    }
+  }
+}
+
+// Random command stream with long runs and back references that overlap
+// their output or point past it.
+static int GenerateLzStream(uint8 *out, int size, bool big_endian_offs, uint32 *seed) {
+  int pos = 0, n = 0;
+  while (pos < size) {
+    int len = IntMin(1 + (Test_Rand(seed) % 4 ? Test_Rand(seed) % 40 : Test_Rand(seed) % 1024), size - pos);
+    int cmd = Test_Rand(seed) % 5;
+    if (len > 32 || Test_Rand(seed) % 8 == 0) {
+      out[n++] = 0xe0 | cmd << 2 | (len - 1) >> 8;
+      out[n++] = (len - 1) & 0xff;
+    } else {
+      out[n++] = cmd << 5 | (len - 1);
+    }
+    if (cmd == 0) {
+      for (int i = 0; i < len; i++)
+        out[n++] = Test_Rand(seed);
+    } else if (cmd == 2) {
+      out[n++] = Test_Rand(seed), out[n++] = Test_Rand(seed);
+    } else if (cmd == 4) {
+      int offs = (Test_Rand(seed) % 3 == 0 || pos == 0) ? Test_Rand(seed) % 0x4000 : pos - 1 - Test_Rand(seed) % IntMin(pos, 40);
+      out[n++] = big_endian_offs ? offs >> 8 : offs;
+      out[n++] = big_endian_offs ? offs : offs >> 8;
+    } else {
+      out[n++] = Test_Rand(seed);
+    }
+    pos += len;
+  }
+  out[n++] = 0xff;
+  return n;
+}
+
+void Test_Lz() {
+  enum { kFuzzRounds = 20000 };
+  static const char *const kNames[4] = { "kSprGfx", "kBgGfx", "kOverworld_Hibytes", "kOverworld_Lobytes" };
+  uint8 *src = malloc(0x20000), *a = malloc(0x20000), *b = malloc(0x20000);
+  if (!src || !a || !b)
+    Die("Out of memory");
+  uint32 seed = 1;
+  for (int i = 0; i < kFuzzRounds; i++) {
+    bool big_endian_offs = i & 1;
+    GenerateLzStream(src, 1 + seed % 0x3000, big_endian_offs, &seed);
+    // Back references can read past the output, so both start from the same garbage.
+    for (int j = 0; j < 0x10000; j++)
+      a[j] = b[j] = (uint8)(j * 131 + i);
+    int la = LzDecompress_Reference(a, src, big_endian_offs), lb = LzDecompress(b, src, big_endian_offs);
+    TEST_CHECK(la == lb && memcmp(a, b, 0x10000) == 0, "lz: random stream %d decodes differently", i);
+  }
+  if (Test_InitGame()) {
+    for (int kind = 0; kind < 4; kind++) {
+      for (int i = 0;; i++) {
+        MemBlk blk = kind == 0 ? kSprGfx(i) : kind == 1 ? kBgGfx(i) :
+                     kind == 2 ? kOverworld_Hibytes_Comp(i) : kOverworld_Lobytes_Comp(i);
+        if (!blk.ptr)
+          break;
+        // Uncompressed sprite sheets are copied as is by Decomp_spr.
+        if (blk.size == 0 || (kind == 0 && (i < 12 || (i < 103 && blk.size == 0x600))))
+          continue;
+        bool big_endian_offs = kind >= 2;
+        memset(a, 0, 0x10000), memset(b, 0, 0x10000);
+        int la = LzDecompress_Reference(a, blk.ptr, big_endian_offs), lb = LzDecompress(b, blk.ptr, big_endian_offs);
+        TEST_CHECK(la == lb && memcmp(a, b, la) == 0, "lz: %s %d decodes differently", kNames[kind], i);
+      }
+    }
+  }
+  free(src), free(a), free(b);
+}
@@ -0,0 +1,60 @@
+// Runs the DSP blocks through the resampler at every quality, up to output
+// rates where a block is several thousand frames. A constant input has to
+// come out unchanged once the silent history is gone, and the mono output
+// has to be the stereo output mixed down.
+#include <stdlib.h>
+#include <string.h>
+#include "test_util.h"
+#include "src/resampler.h"
+
+enum {
+  kResamplerTest_InFrames = 534,
+  kResamplerTest_Blocks = 40,
+  kResamplerTest_DcBlocks = 10,
+  kResamplerTest_MaxOut = kResamplerTest_InFrames * 192000 / 32000 + 1,
+};
+
+static const uint32 kResamplerTestRates[] = { 22050, 44100, 48000, 96000, 192000 };
+
+void Test_Resampler() {
+  int16 *in = malloc(sizeof(int16) * kResamplerTest_InFrames * 2);
+  int16 *stereo = malloc(sizeof(int16) * kResamplerTest_MaxOut * 2);
+  int16 *mono = malloc(sizeof(int16) * kResamplerTest_MaxOut);
+  Resampler *rs = calloc(2, sizeof(Resampler));
+  if (!in || !stereo || !mono || !rs)
+    Die("Out of memory");
+  uint32 seed = 1;
+  for (int quality = 0; quality < kResampler_NumQualities; quality++) {
+    for (int j = 0; j < countof(kResamplerTestRates); j++) {
+      uint32 rate = kResamplerTestRates[j];
+      Resampler_Init(&rs[0], quality, 32000, rate);
+      Resampler_Init(&rs[1], quality, 32000, rate);
+      uint32 frac = 0;
+      for (int block = 0; block < kResamplerTest_Blocks; block++) {
+        bool dc = block < kResamplerTest_DcBlocks;
+        for (int i = 0; i < kResamplerTest_InFrames; i++) {
+          in[i * 2 + 0] = dc ? 1000 : (int16)Test_Rand(&seed);
+          in[i * 2 + 1] = dc ? -2000 : (int16)Test_Rand(&seed);
+        }
+        // Output sizes vary by a frame like with the rate control.
+        frac += kResamplerTest_InFrames * rate;
+        uint32 n = frac / 32000;
+        frac %= 32000;
+        Resampler_ProcessBlock(&rs[0], in, kResamplerTest_InFrames, stereo, n);
+        Resampler_ProcessBlockMono(&rs[1], in, kResamplerTest_InFrames, mono, n);
+        int bad = 0;
+        for (uint32 i = 0; i < n; i++) {
+          if (dc && block >= 2 && (stereo[i * 2] != 1000 || stereo[i * 2 + 1] != -2000))
+            bad |= 1;
+          if (mono[i] != ((stereo[i * 2] + stereo[i * 2 + 1]) >> 1))
+            bad |= 2;
+        }
+        TEST_CHECK(!(bad & 1), "resampler: quality %d at %u Hz changes a constant in block %d", quality, rate, block);
+        TEST_CHECK(!(bad & 2), "resampler: quality %d at %u Hz mono differs in block %d", quality, rate, block);
+      }
+    }
+  }
+  Resampler_Destroy(&rs[0]);
+  Resampler_Destroy(&rs[1]);
+  free(in), free(stereo), free(mono), free(rs);
+}
@@ -0,0 +1,73 @@
+// Checks that the rollout server turns down requests whose observations
+// don't fit, and keeps serving the ones that do. Only the start state is
+// used, so it runs without the assets too.
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "test_util.h"
+#include "src/platform/lib/libzelda3.h"
+#include "src/zelda_rtl.h"
+
+static int RolloutTest_Connect(const char *path) {
+  // The server may not be listening yet.
+  for (int i = 0; i < 500; i++) {
+    int fd = Zelda3Rollout_Connect(path);
+    if (fd >= 0)
+      return fd;
+    usleep(10000);
+  }
+  return -1;
+}
+
+static bool RolloutTest_Run(const char *path, const Zelda3RolloutRequest *req, Zelda3RolloutResult *res) {
+  int fd = RolloutTest_Connect(path);
+  TEST_CHECK(fd >= 0, "rollout: can't connect to %s", path);
+  if (fd < 0)
+    return false;
+  memset(res, 0, sizeof(*res));
+  bool ok = Zelda3Rollout_Run(fd, req, NULL, res, NULL, NULL);
+  close(fd);
+  return ok;
+}
+
+void Test_Rollout() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/zelda3_test_%d.sock", (int)getpid());
+  fflush(stdout);
+  pid_t server = fork();
+  if (server < 0)
+    Die("fork failed");
+  if (server == 0) {
+    if (!Test_InitGame())
+      ZeldaInitialize();
+    Zelda3_ServeRollouts(path);
+    _exit(1);
+  }
+
+  // Every range is in the RAM, but together they are eight times its size.
+  Zelda3RolloutRequest req = { .num_ram_ranges = kZelda3_RolloutMaxRamRanges };
+  for (int i = 0; i < kZelda3_RolloutMaxRamRanges; i++)
+    req.ram_ranges[i] = (Zelda3RamRange){ 0, kZelda3_RamSize };
+  Zelda3RolloutResult res;
+  TEST_CHECK(!RolloutTest_Run(path, &req, &res) && !res.ok, "rollout: overlapping RAM ranges were accepted");
+
+  // All of the RAM in two halves and a full frame is the most that fits.
+  req.num_ram_ranges = 2;
+  req.ram_ranges[0] = (Zelda3RamRange){ 0, kZelda3_RamSize / 2 };
+  req.ram_ranges[1] = (Zelda3RamRange){ kZelda3_RamSize / 2, kZelda3_RamSize / 2 };
+  req.frame_width = kZelda3_ScreenWidth, req.frame_height = kZelda3_ScreenHeight, req.frame_channels = 3;
+  TEST_CHECK(RolloutTest_Run(path, &req, &res) && res.ram_size + res.frame_size == kZelda3_RolloutMaxObsSize,
+             "rollout: the largest observation was turned down");
+
+  // One byte more.
+  req.num_ram_ranges = 3;
+  req.ram_ranges[2] = (Zelda3RamRange){ 0, 1 };
+  TEST_CHECK(!RolloutTest_Run(path, &req, &res) && !res.ok, "rollout: an observation that doesn't fit was accepted");
+
+  kill(server, SIGKILL);
+  waitpid(server, NULL, 0);
+  unlink(path);
+}
@@ -0,0 +1,84 @@
+#include "test_util.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <SDL.h>
+#include "src/asset_loader.h"
+#include "src/util.h"
+#include "src/zelda_rtl.h"
+#include "snes/ppu.h"
+
+int g_test_failures;
+bool g_test_skipped;
+
+void Test_Fail(const char *file, int line, const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  fprintf(stderr, "%s:%d: ", file, line);
+  vfprintf(stderr, fmt, va);
+  fputc('\n', stderr);
+  va_end(va);
+  g_test_failures++;
+}
+
+bool Test_InitGame() {
+  static int state;  // 0 not tried, 1 ready, 2 no assets
+  if (state == 0) {
+    const char *path = getenv("ZELDA3_ASSETS");
+    if (!path)
+      path = "zelda3_assets.dat";
+    if (access(path, R_OK) != 0) {
+      state = 2;
+    } else {
+      LoadAssets(path);
+      ZeldaInitialize();
+      // Like libzelda3, frames are drawn without the widescreen sides.
+      g_zenv.ppu->extraLeftRight = 0;
+      state = 1;
+    }
+  }
+  g_test_skipped |= (state != 1);
+  return state == 1;
+}
+
+uint32 Test_Rand(uint32 *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+uint64 Test_Ticks() {
+  return SDL_GetPerformanceCounter();
+}
+
+double Test_TicksToUs(uint64 ticks) {
+  return ticks * 1e6 / (double)SDL_GetPerformanceFrequency();
+}
+
+void Test_RunCachePasses(const CachePasses *c, int warm_rounds, CachePassResult res[kCachePass_Count]) {
+  int calls = c->num_calls();
+  for (int pass = 0; pass < kCachePass_Count; pass++) {
+    CachePassResult *r = &res[pass];
+    r->rounds = (pass == kCachePass_Warm) ? warm_rounds : 1;
+    c->set_enabled(pass != kCachePass_Uncached);
+    if (pass == kCachePass_Cold)
+      c->clear();
+    *c->hits = *c->misses = 0;
+    r->hash = FNV1A_INIT, r->ticks = r->worst = 0;
+    for (int round = 0; round < r->rounds; round++) {
+      for (int i = 0; i < calls; i++) {
+        uint64 before = Test_Ticks();
+        c->call(i);
+        uint64 t = Test_Ticks() - before;
+        r->ticks += t;
+        r->worst = t > r->worst ? t : r->worst;
+        if (round == 0) {
+          r->hash = HashFnv1a(r->hash, g_zenv.ram, 0x20000);
+          if (c->hash_vram)
+            r->hash = HashFnv1a(r->hash, g_zenv.vram, 0x10000);
+        }
+      }
+    }
+    r->hits = *c->hits, r->misses = *c->misses;
+  }
+  c->set_enabled(true);
+}
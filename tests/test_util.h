@@ -0,0 +1,59 @@
+// Helpers shared by zelda3_test and zelda3_engine_bench. Both link the
+// library objects directly instead of libzelda3.so, so they can reach the
+// game internals that the library doesn't export.
+#ifndef ZELDA3_TESTS_TEST_UTIL_H_
+#define ZELDA3_TESTS_TEST_UTIL_H_
+
+#include "src/types.h"
+
+// Records a failure and carries on, so one run reports every mismatch.
+#define TEST_CHECK(cond, ...) do { if (!(cond)) Test_Fail(__FILE__, __LINE__, __VA_ARGS__); } while (0)
+void Test_Fail(const char *file, int line, const char *fmt, ...);
+extern int g_test_failures;
+
+// Loads the assets and initializes the game the first time it's called.
+// The assets come from $ZELDA3_ASSETS or zelda3_assets.dat. Returns false
+// and sets g_test_skipped when there are none, and the callers skip what
+// needs the game.
+bool Test_InitGame();
+extern bool g_test_skipped;
+
+uint32 Test_Rand(uint32 *seed);
+
+// Monotonic clock in ticks of SDL_GetPerformanceFrequency.
+uint64 Test_Ticks();
+double Test_TicksToUs(uint64 ticks);
+
+// A cache that can be switched off, and the calls that go through it.
+typedef struct CachePasses {
+  int (*num_calls)();  // per round
+  void (*call)(int i);
+  void (*set_enabled)(bool enabled);
+  void (*clear)();
+  uint32 *hits, *misses;  // the counters of the cache
+  bool hash_vram;
+} CachePasses;
+
+enum {
+  kCachePass_Uncached,
+  kCachePass_Cold,
+  kCachePass_Warm,
+  kCachePass_Count,
+};
+
+typedef struct CachePassResult {
+  uint64 hash;  // WRAM, and VRAM if asked for, after each call of the first round
+  uint64 ticks, worst;  // all calls, and the slowest one
+  int rounds;
+  uint32 hits, misses;
+} CachePassResult;
+
+// Runs the calls once without the cache, once from a cleared cache and then
+// |warm_rounds| times warm. The hashes must match for the cache to be
+// invisible. Leaves the cache enabled.
+void Test_RunCachePasses(const CachePasses *c, int warm_rounds, CachePassResult res[kCachePass_Count]);
+
+// In cache_test.c, shared with the benchmarks.
+extern const CachePasses kGfxSheetCachePasses, kOverworldQuadrantCachePasses;
+
+#endif  // ZELDA3_TESTS_TEST_UTIL_H_
@@ -0,0 +1,43 @@
+// Regression tests for the parts of the engine that have fast paths next to
+// a reference. Run with make test, or pass test names to run only those.
+// The tests that step the game need real assets and are skipped without them.
+#include <stdio.h>
+#include <string.h>
+#include "test_util.h"
+
+void Test_Dsp();
+void Test_FrameElision();
+void Test_GfxSheetCache();
+void Test_Lz();
+void Test_OverworldQuadrantCache();
+void Test_Resampler();
+void Test_Rollout();
+
+static const struct {
+  const char *name;
+  void (*func)();
+} kTests[] = {
+  { "dsp", &Test_Dsp },
+  { "lz", &Test_Lz },
+  { "resampler", &Test_Resampler },
+  { "gfx_cache", &Test_GfxSheetCache },
+  { "ow_cache", &Test_OverworldQuadrantCache },
+  { "frames", &Test_FrameElision },
+  { "rollout", &Test_Rollout },
+};
+
+int main(int argc, char **argv) {
+  for (int i = 0; i < countof(kTests); i++) {
+    bool wanted = (argc <= 1);
+    for (int j = 1; j < argc; j++)
+      wanted |= (strcmp(argv[j], kTests[i].name) == 0);
+    if (!wanted)
+      continue;
+    int failures_before = g_test_failures;
+    g_test_skipped = false;
+    kTests[i].func();
+    printf("%-12s %s\n", kTests[i].name, g_test_failures != failures_before ? "FAILED" :
+           g_test_skipped ? "ok, without the assets" : "ok");
+  }
+  return g_test_failures != 0;
+}